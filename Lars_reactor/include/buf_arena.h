@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+//大块内存分配区：1M及以上刻度的io_buf内存从这里切，不再每块单独new。
+//向系统mmap整片的区域(ARENA_REGION_SIZE)，按2MB对齐并madvise(MADV_HUGEPAGE)，
+//内核支持透明大页时这些内存用2MB页映射，拷贝大的路由包时TLB缺失少；不支持时就是普通页，照常使用。
+//不加锁，由buf_pool在持有自己的锁时调用。
+
+//每片区域大小，是所有大块刻度的整数倍
+#define ARENA_REGION_SIZE (32*1024*1024)
+//大页大小
+#define ARENA_HUGE_PAGE (2*1024*1024)
+
+//分配区统计
+struct arena_stat{
+    int regions;            //已映射的区域数
+    uint64_t mapped_kb;     //已映射的内存
+    uint64_t free_kb;       //切出后又归还、等待复用的内存(已MADV_DONTNEED，不占物理内存)
+    bool huge;              //madvise(MADV_HUGEPAGE)是否成功
+};
+
+class buf_arena{
+public:
+    buf_arena();
+
+    //切一块cap大小的内存。cap须整除ARENA_REGION_SIZE。映射失败返回nullptr，由调用方退回new
+    char* alloc(int cap);
+
+    //归还一块内存，物理页还给系统(MADV_DONTNEED)，地址留着给同刻度复用
+    void revert(char* p, int cap);
+
+    //p是否是从本分配区切出的
+    bool owns(const char* p);
+
+    void get_stats(arena_stat& stat);
+
+private:
+    //映射一片新的区域
+    bool map_region();
+
+    //已映射的区域起始地址
+    vector<char*> _regions;
+    //当前区域切到哪里
+    char* _cur;
+    char* _end;
+
+    //各刻度归还的内存，cap -> 地址列表。大块刻度只有几个，线性查找
+    vector<pair<int, vector<char*>>> _free_lists;
+    uint64_t _free_kb;
+
+    bool _huge;
+};
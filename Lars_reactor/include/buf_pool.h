@@ -1,15 +1,19 @@
 #pragma once
 #include "io_buf.h"
+#include "buf_arena.h"
 #include <mutex>
-#include <unordered_map>
+#include <atomic>
+#include <vector>
+#include <cstdint>
 using namespace std;
 
 //内存池单例模式
 
-//总内存大小上限，单位kb
+class event_loop;
+
+//总内存大小上限(硬上限默认值)，单位kb
 #define MEM_LIMIT (5U*1024*1024)
 
-using pool_t = unordered_map<int, io_buf*>;
 
 //定义一些内存刻度
 enum MEM_CAP{
@@ -22,6 +26,27 @@ enum MEM_CAP{
     m8M = 8388608,
 };
 
+//刻度个数
+#define MEM_CLASS_NUM 7
+
+//每个刻度的统计
+struct buf_class_stat{
+    int cap;            //刻度
+    uint64_t allocs;    //申请次数
+    uint64_t hits;      //直接从线程缓存拿到、没有加锁的次数
+    int pooled;         //总内存池中空闲的块数(不含线程缓存)
+};
+
+//内存池整体用量，单位kb
+struct buf_mem_stat{
+    uint64_t total_kb;      //已向系统申请的内存(回收释放的已减去)
+    uint64_t cached_kb;     //总内存池中空闲的内存
+    uint64_t used_kb;       //正在使用的内存 = total - cached，含各线程缓存中的块(每线程每刻度最多两批)
+    uint64_t soft_limit_kb; //软上限：超过后链接暂停读
+    uint64_t hard_limit_kb; //硬上限：超过后不再向系统申请，申请失败
+    uint64_t alloc_fails;   //因硬上限申请失败的次数
+};
+
 class buf_pool{
 public:
     static buf_pool* get_instance(){
@@ -42,6 +67,31 @@ public:
     //生成pool池复用
     void make_io_buf_list(int cap, int num);
 
+    //按[reactor]配置预分配并设置低水位，设置软硬上限，启动定时回收。由tcp_server构造时调用，只生效一次。
+    //bufPoolInit形如"4K:512,16K:64"：各刻度预分配的块数，也是回收时保留的块数(低水位)，默认不预分配
+    //bufPoolSoftLimit、bufPoolHardLimit：软硬上限(MB)
+    //bufPoolHugeArena：1M及以上刻度是否从大页分配区切，默认true
+    //bufPoolTrimSec：回收间隔(秒)，0为不回收
+    void load_config(event_loop* loop);
+
+    //回收：各刻度在上一个回收周期内一直空闲的块，超过低水位的部分释放还给系统。可在任意线程调用
+    void trim();
+
+    //正在使用的内存是否超过软上限。不加锁，tcp_conn每次读之前检查，超过就暂停读(TCP背压)
+    bool over_soft_limit(){
+        return _used_kb.load(memory_order_relaxed) >= _soft_limit_kb.load(memory_order_relaxed);
+    }
+
+    //整体用量(传出参数)
+    void get_mem_stats(buf_mem_stat& stat);
+
+    //大块分配区统计(传出参数)
+    void get_arena_stats(arena_stat& stat);
+
+    //各刻度的申请次数和线程缓存命中次数(传出参数)。
+    //线程缓存中的计数在加锁补货/回填或线程退出时才汇总，统计会略微滞后
+    void get_stats(vector<buf_class_stat>& stats);
+
 private:
     //=======================1.单例模式==========================
     buf_pool();
@@ -54,11 +104,53 @@ private:
     static once_flag _once_flag;
 
     //===================2.pool内存池属性==========================
-    //存放所有io_buf的map句柄，总内存池
-    pool_t _pool;
+    //每个线程(即每个event_loop)一份的缓存，见buf_pool.cpp
+    friend struct thread_cache;
+
+    //从总内存池批量取n块第idx个刻度的内存，串成链表返回。加锁
+    //空闲的不够时向系统申请，到硬上限为止；n传出实际取到的块数，一块都取不到返回nullptr
+    io_buf* fetch_batch(int idx, int& n);
+
+    //把一串n块第idx个刻度的内存(first到last)还回总内存池。加锁
+    void spill_batch(int idx, io_buf* first, io_buf* last, int n);
+
+    //向系统申请/释放一块第idx个刻度的内存。大块刻度走_arena。加锁调用
+    io_buf* new_buf(int idx);
+    void delete_buf(io_buf* buf);
+
+    //大块刻度的分配区，及是否使用
+    buf_arena _arena;
+    bool _use_arena;
+
+    //按刻度下标存放所有io_buf链表，总内存池
+    io_buf* _pool[MEM_CLASS_NUM];
 
-    //当前内存池大小，单位kb
+    //各刻度总内存池中的空闲块数、上次回收以来的最少空闲块数、低水位。加锁访问
+    int _free_cnt[MEM_CLASS_NUM];
+    int _min_free[MEM_CLASS_NUM];
+    int _low_water[MEM_CLASS_NUM];
+
+    //load_config只生效一次(一个进程可能有多个tcp_server)
+    bool _configured;
+
+    //各刻度的统计，线程缓存批量汇总上来，不加锁
+    atomic<uint64_t> _allocs[MEM_CLASS_NUM];
+    atomic<uint64_t> _misses[MEM_CLASS_NUM];
+
+    //当前内存池大小(已向系统申请的内存)，总内存池中空闲的内存，单位kb。加锁访问
     uint64_t _mem_capacity;
+    uint64_t _cached_kb;
+
+    //正在使用的内存，每次加锁修改上面两个值后更新，供over_soft_limit不加锁读取
+    atomic<uint64_t> _used_kb;
+    void update_used();
+
+    //软、硬上限，单位kb
+    atomic<uint64_t> _soft_limit_kb;
+    uint64_t _hard_limit_kb;
+
+    //因硬上限申请失败的次数
+    atomic<uint64_t> _alloc_fails;
 
     //确保多线程操作pool增删改时线程安全的锁
     static mutex _mutex;
@@ -8,8 +8,11 @@ class event_loop;   //前置声明，两个头文件不能互相包含
 
 using io_callback = void (event_loop* loop, int fd, void* args);    //定义epoll检测触发的回调
 
+#include <cstdint>
+
 struct event_handler{
-    event_handler():mask(0), read_callback(nullptr), write_callback(nullptr), rcb_args(nullptr), wcb_args(nullptr){};
+    event_handler():mask(0), read_callback(nullptr), write_callback(nullptr), rcb_args(nullptr), wcb_args(nullptr),
+                    fd(-1), del_batch(0){};
 
     //事件的位掩码。EPOLLIN、EPOLLOUT
     int mask;
@@ -21,6 +24,10 @@ struct event_handler{
     void* rcb_args;
     //写事件回调函数形参
     void* wcb_args;
+    //该handler对应的fd。epoll_event.data.ptr直接指向handler时，靠它拿到fd
+    int fd;
+    //在第几轮epoll_wait的分发中被删除。本轮后续指向它的事件都已过期，直接跳过
+    uint64_t del_batch;
 };
 
 
@@ -2,26 +2,80 @@
 #pragma once
 
 #include "event_handler.h"
-#include <unordered_map>
+#include "timer_queue.h"
 #include <unordered_set>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
 #include <sys/epoll.h>
-#define MAX_EVENTS 10
+//每次epoll_wait最多取回的事件数，初始值和上限。一次取满说明积压，数组自动翻倍
+#define EPOLL_BATCH_INIT 128
+#define EPOLL_BATCH_MAX 65536
+//空闲链接时间轮：每格IDLE_TICK_MS，共IDLE_WHEEL_SLOTS格。更远的到期时刻先放到最后一格，到时再检查一次
+#define IDLE_TICK_MS 1000
+#define IDLE_WHEEL_SLOTS 64
 using namespace std;
 
-//优化点之一，建立fd到检测回调的映射
-using fd2handler = unordered_map<int, event_handler>;
+//优化点之一，建立fd到检测回调的映射。
+//fd是小而稠密的整数，直接用fd做下标的连续数组，分发时一次下标访问，无需哈希查找
+using fd2handler = vector<event_handler>;
 
 using listen_fds = unordered_set<int>;
 
 //异步任务回调类型
 using task_callback = void (*)(event_loop* loop, void* args);
 
-using ready_tasks = unordered_map<task_callback, void*>;
+//可携带捕获的异步任务。小的lambda(不超过两个指针)在std::function内部存放，不分配内存
+using task_func = function<void(event_loop* loop)>;
+
+//一个异步任务。cb非空时走函数指针+参数的快速路径，否则执行func
+struct async_task{
+    task_callback cb;
+    void* args;
+    task_func func;
+};
+
+//异步任务队列，按投递顺序执行，同一回调投递多次就执行多次
+using ready_tasks = vector<async_task>;
+
+//跨线程投递任务的收件箱，thread_queue.hpp包含本头文件，这里只能前置声明
+template<typename T> class thread_queue;
+
+class net_connection;
+
+//链接句柄：高32位为代数，低32位为fd。同一fd每建立一次链接代数加一，
+//fd关闭后被新链接复用时旧句柄查不到，其他线程拿着句柄不会把消息发给错误的链接。0为无效句柄
+using conn_id = uint64_t;
+
+//链接表的一项，下标即fd
+struct conn_slot{
+    net_connection* conn;   //当前链接，没有则为nullptr
+    uint32_t gen;           //代数，每次add_conn加一
+};
+
+//loop运行统计，用于调优epollBatch
+struct loop_stats{
+    uint64_t waits;             //epoll_wait总次数
+    uint64_t events;            //取回的事件总数
+    uint64_t full_waits;        //取满整个数组的次数
+    uint64_t iters_per_sec;     //最近一秒的循环次数
+    int batch_size;             //当前事件数组大小
+    int conns;                  //当前归属本loop的链接数
+    uint64_t flushes;           //攒写模式下本轮末尾flush链接的次数(每次一个writev)
+    uint64_t flush_blocked;     //flush没写完(EAGAIN)、挂上EPOLLOUT的次数
+};
 
 class event_loop{
 public:
     event_loop();
 
+    ~event_loop();
+
     //循环阻塞监听事件，并处理。事件堆自己调用。
     void event_process();
 
@@ -36,34 +90,222 @@ public:
     //删除一个io事件的某个事件位掩码。上个函数的重载版本。
     void del_io_event(int fd, int mask);
 
+    //同上，但不打印日志，fd不在监听中也不报错。供暂停读、暂停accept这类高频且可能重复的操作使用
+    void clear_io_mask(int fd, int mask);
+
     //====================异步任务方法===================
-    //添加一个task任务到异步任务集合中
+    //添加一个task任务到异步任务队列尾部。只能在loop线程调用，其他线程通过thread_queue投递
     void add_task(task_callback task_cb, void* args);
 
-    //执行全部异步任务
+    //添加一个可携带捕获的task任务，如[conn](event_loop*){ ... }
+    void add_task(task_func task);
+
+    //按投递顺序执行全部异步任务。执行中新投递的任务留到下一轮
     void execute_ready_tasks();
 
-    //获取当前loop中监听fd集合
-    void get_listen_fds(listen_fds& fds){
-        fds = _listen_fds;
+    //====================跨线程投递===================
+    //任意线程都可调用。已在本loop线程则立即执行，否则投递到收件箱，由本loop线程按投递顺序执行
+    void run_in_loop(task_func task);
+
+    //任意线程都可调用。总是排队：本loop线程内放到本轮末尾执行，其他线程投递到收件箱并唤醒loop
+    void queue_in_loop(task_func task);
+
+    //当前是否在本loop线程。event_process启动前loop不属于任何线程，一律返回false，投递的任务都进收件箱
+    bool is_in_loop_thread(){
+        return _owned.load(memory_order_acquire) && pthread_equal(_owner, pthread_self());
     }
 
+    //====================定时器方法===================
+    //以下只能在loop线程(或event_process启动前)调用。返回定时器id，用于cancel_timer
+    
+    //在单调时钟when_ms(见now_ms)时刻执行一次
+    int run_at(uint64_t when_ms, timer_callback cb, void* args = NULL);
+
+    //delay_ms毫秒后执行一次
+    int run_after(uint64_t delay_ms, timer_callback cb, void* args = NULL);
+
+    //每隔interval_ms毫秒执行一次，第一次在interval_ms后
+    int run_every(uint64_t interval_ms, timer_callback cb, void* args = NULL);
+
+    //取消一个定时器。回调中取消自己也是安全的
+    void cancel_timer(int timer_id);
+
+    //当前单调时钟，ms
+    static uint64_t now_ms(){
+        return timer_queue::now_ms();
+    }
+
+    //本轮epoll_wait返回时的单调时钟，ms。链接记录活跃时间等不需要精确的地方用它，不必每次取时钟
+    uint64_t iter_ms(){
+        return _iter_ms;
+    }
+
+    //获取当前loop中监听fd集合(传出参数)。由位图生成，只在需要遍历时调用
+    void get_listen_fds(listen_fds& fds);
+
+    //某个fd是否正在被当前loop监听
+    bool is_listening(int fd){
+        return fd >= 0 && fd < (int)_handlers.size() && (_listen_bits[fd / 64] >> (fd % 64) & 1);
+    }
+
+    //====================触发模式===================
+    //设置整个loop为边缘触发(EPOLLET)。之后add_io_event的fd都会带上EPOLLET。
+    //也可以不开整体模式，只在add_io_event的mask中加EPOLLET，单独对某个fd生效。
+    void set_edge_trigger(bool on){
+        _edge_trigger = on;
+    }
+
+    //某个fd当前是否为边缘触发。ET模式下读写必须一直循环到EAGAIN，否则会丢事件。
+    bool is_edge_trigger(int fd);
+
+    //设置每次epoll_wait最多取回的事件数。必须在event_process启动前调用
+    void set_epoll_batch(int batch);
+
+    //指针分发模式：epoll_event.data.ptr直接指向handler，分发时不查表。
+    //handler数组按RLIMIT_NOFILE预留容量，保证地址稳定。必须在event_process启动前调用
+    void set_ptr_dispatch(bool on);
+
+    //攒写模式：回调中发送的小消息只拷贝进链接的输出缓冲，本轮所有回调、定时器、任务执行完后
+    //每个链接一次writev写出，写不完(EAGAIN)才挂EPOLLOUT。同一轮的多个响应合成一次系统调用。默认关闭。只能在loop线程调用
+    void set_write_cork(bool on){
+        _write_cork = on;
+    }
+    bool is_write_cork(){
+        return _write_cork;
+    }
+
+    //登记一个有待写数据的链接，本轮末尾调用它的flush_output。链接在此之前关闭则跳过。
+    //只能在loop线程调用；event_process启动前由准备loop的线程调用，攒下的在第一轮末尾写出
+    void add_flush(conn_id id){
+        assert(!_owned.load(memory_order_acquire) || is_in_loop_thread());
+        _flush_list.push_back(id);
+    }
+
+    //从配置文件[reactor]读取loop相关配置(edgeTrigger, epollBatch, ptrDispatch, writeCork)。必须在event_process启动前调用
+    void load_config();
+
+    //获取运行统计，可在其他线程调用(传出参数)
+    void get_stats(loop_stats& stats);
+
+    //归属本loop的链接数。分配链接时(主线程)加一，链接销毁时(本loop线程)减一，供线程池按最少链接分配
+    void add_conn_count(int delta){
+        _conn_cnt.fetch_add(delta, memory_order_relaxed);
+    }
+    int conn_count(){
+        return _conn_cnt.load(memory_order_relaxed);
+    }
+
+    //====================链接表===================
+    //每个loop一张，下标为fd，只在本loop线程访问，不加锁。
+    //以下三个只能在loop线程调用：登记链接返回句柄；摘除链接；按句柄查找，已关闭或fd已复用返回nullptr
+    conn_id add_conn(int fd, net_connection* conn);
+    void del_conn(int fd);
+    net_connection* get_conn(conn_id id);
+
+    //本loop当前全部链接的句柄(传出参数)。只能在loop线程调用
+    void get_conn_ids(vector<conn_id>& ids);
+
+    //向本loop的某个链接发消息，可在任意线程调用。数据拷贝一份投递到loop线程，
+    //到时链接已关闭(句柄失效)则丢弃
+    void send_to_conn(conn_id id, const char* data, int msglen, int msgid);
+
+    //====================空闲检查===================
+    //按秒分格的时间轮，格子里是到期时刻落在这一秒的链接句柄。链接读写只更新自己的活跃时间，不动时间轮；
+    //到期时调用链接的check_idle，还没空闲够的按它返回的时刻重新放回轮中。只能在loop线程调用
+    void add_idle_check(conn_id id, uint64_t when_ms);
+
 private:
     int _epfd;      //epoll_create创建
+
+    //是否整个loop使用边缘触发
+    bool _edge_trigger;
+
+    //是否使用指针分发模式
+    bool _ptr_dispatch;
+
+    //是否攒写
+    bool _write_cork;
+
+    //当前是第几轮分发，配合event_handler::del_batch识别本轮已删除的handler
+    uint64_t _batch_no;
+
+    //fd超出数组范围时扩容
+    void grow_handlers(int fd);
+
+    //按当前模式把所有已注册fd重新上树(data.fd或data.ptr)
+    void rebind_handlers();
+
+    //填充epoll_event的data字段
+    void fill_event_data(struct epoll_event& ev, int fd){
+        if(_ptr_dispatch)   ev.data.ptr = &_handlers[fd];
+        else                ev.data.fd = fd;
+    }
     
-    //当前事件堆中fd到检测函数的映射
-    fd2handler _fd2handler;    
+    //当前事件堆中fd到检测函数的映射，下标即fd，按需扩容
+    fd2handler _handlers;    
+
+    //链接表，下标即fd，按需扩容
+    vector<conn_slot> _conn_table;
 
-    //当前事件堆在检测哪些fd。即wait正在监控哪些fd。
+    //当前事件堆在检测哪些fd。即wait正在监控哪些fd。位图，第fd位为1表示在监听，与_handlers同步扩容
     //作用是服务器可以主动向客户端发消息。以及epoll_wait中便于检测监听fd是否正确
-    listen_fds _listen_fds;
+    vector<uint64_t> _listen_bits;
 
     //每次epoll_wait的检测到的事件数组，epoll_ctl传出参数。
-    //fired开源项目中的约定俗成，意味就绪。
-    struct epoll_event _fired_evs[MAX_EVENTS];
+    //fired开源项目中的约定俗成，意味就绪。一次取满时翻倍，最大EPOLL_BATCH_MAX
+    vector<struct epoll_event> _fired_evs;
 
-    //异步任务集合
+    //运行统计。只有loop线程写，其他线程读，用relaxed原子量即可
+    atomic<uint64_t> _stat_waits;
+    atomic<uint64_t> _stat_events;
+    atomic<uint64_t> _stat_full_waits;
+    atomic<uint64_t> _stat_iters_per_sec;
+    atomic<int> _stat_batch_size;
+    atomic<int> _conn_cnt;
+    atomic<uint64_t> _stat_flushes;
+    atomic<uint64_t> _stat_flush_blocked;
+    //统计每秒循环次数用
+    time_t _stat_sec;
+    uint64_t _stat_iters;
+
+    //异步任务队列
     ready_tasks _ready_tasks;
+    //正在执行的一批任务，与_ready_tasks交换，两者容量都保留，稳定后不再分配内存
+    ready_tasks _running_tasks;
+
+    //本轮有待写数据的链接句柄，本轮末尾统一flush
+    vector<conn_id> _flush_list;
+    //正在flush的一批，与_flush_list交换
+    vector<conn_id> _flushing;
+
+    //本轮末尾flush全部登记的链接
+    void flush_pending();
+
+    //本轮epoll_wait返回时的单调时钟
+    uint64_t _iter_ms;
+
+    //空闲检查时间轮，第i格是到期秒数%IDLE_WHEEL_SLOTS为i的链接句柄
+    vector<vector<conn_id>> _idle_wheel;
+    //时间轮已处理到哪一秒
+    uint64_t _idle_sec;
+    //驱动时间轮的定时器，第一次add_idle_check时启动，-1为未启动
+    int _idle_timer;
+
+    //每IDLE_TICK_MS处理一次到期的格子
+    static void idle_tick(event_loop* loop, void* args);
+
+    //定时器集合，堆顶决定epoll_wait的超时时间
+    timer_queue _timers;
+
+    //运行本loop的线程，event_process启动时设置，之后不再改变。_owned置位后_owner才有效
+    pthread_t _owner;
+    atomic<bool> _owned;
+
+    //跨线程任务收件箱。无锁MPSC队列，由空变非空时写一次eventfd唤醒本loop
+    unique_ptr<thread_queue<task_func>> _inbox;
+
+    //收件箱eventfd可读时的回调，取出全部任务按序执行
+    static void do_inbox(event_loop* loop, int fd, void* args);
 };
 
 
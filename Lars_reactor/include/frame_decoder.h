@@ -0,0 +1,106 @@
+//消息帧解析，tcp_conn、tcp_client、udp_server、udp_client共用
+#pragma once
+#include "message.h"
+#include "reactor_buf.h"
+#include <cstring>
+#include <arpa/inet.h>
+
+//从p处读4字节，p不需要对齐。定长memcpy会被编译成一条非对齐load，不会真的调用memcpy
+inline uint32_t load_u32(const char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//TCP消息头为网络字节序
+inline void parse_head(const char* p, int& msgid, int& msglen){
+    msgid = ntohl(load_u32(p));
+    msglen = ntohl(load_u32(p + 4));
+}
+
+//消息体长度是否合法
+inline bool valid_msglen(int msglen){
+    return msglen >= 0 && msglen <= MESSAGE_LENGTH_LIMIT;
+}
+
+//解析_ibuf中全部完整的消息，每个调用一次handler(msgid, msglen, data)，不完整的留在缓冲中等下次。
+//链表头io_buf里连续的完整消息直接在块内逐个解析，整批处理完只pop一次；
+//只有跨块的消息才走peek拼接，还没收全的消息先reserve。
+//handler返回false表示链接已在回调中关闭(缓冲已清空)，立即停止，不再碰缓冲。
+//每次pop之前调用flush()：handler可以只记下消息的指针(如msg_batch攒批)，flush时再处理，
+//pop之后这些指针就失效了。flush返回false同handler。正常返回时已经flush过，没有攒着的消息
+//返回解析出的消息数，消息长度非法或拼接申请不到内存返回-1，调用方应关闭链接
+template<typename HANDLER, typename FLUSH>
+inline int decode_frames(input_buf& ibuf, HANDLER&& handler, FLUSH&& flush){
+    int frames = 0;
+    int msgid, msglen;
+
+    while(ibuf.length() >= MESSAGE_HEAD_LEN){
+        //1. 链表头块中的连续数据，一批解析
+        int avail;
+        const char* p = ibuf.front(avail);
+        int used = 0;
+        while(avail - used >= MESSAGE_HEAD_LEN){
+            parse_head(p + used, msgid, msglen);
+            if(!valid_msglen(msglen))
+                return -1;
+            if(avail - used - MESSAGE_HEAD_LEN < msglen)
+                break;
+            if(!handler(msgid, msglen, p + used + MESSAGE_HEAD_LEN))
+                return frames;
+            used += MESSAGE_HEAD_LEN + msglen;
+            ++frames;
+        }
+        if(used > 0){
+            if(!flush())
+                return frames;
+            ibuf.pop(used);
+            continue;
+        }
+
+        //2. 链表头块开头的消息不完整：跨块了，或者还没收全
+        const char* head = ibuf.peek(MESSAGE_HEAD_LEN);
+        if(!head)
+            return -1;
+        parse_head(head, msgid, msglen);
+        if(!valid_msglen(msglen))
+            return -1;
+        if(ibuf.length() < MESSAGE_HEAD_LEN + msglen){
+            //提前准备好能放下整个包的io_buf，后续数据读进去就是连续的
+            ibuf.reserve(MESSAGE_HEAD_LEN + msglen);
+            break;
+        }
+
+        const char* data = ibuf.peek(MESSAGE_HEAD_LEN + msglen);
+        if(!data)
+            return -1;
+        if(!handler(msgid, msglen, data + MESSAGE_HEAD_LEN) || !flush())
+            return frames;
+        ibuf.pop(MESSAGE_HEAD_LEN + msglen);
+        ++frames;
+    }
+
+    return frames;
+}
+
+//每个消息处理完就不再引用它的handler，不需要flush
+template<typename HANDLER>
+inline int decode_frames(input_buf& ibuf, HANDLER&& handler){
+    return decode_frames(ibuf, handler, [](){ return true; });
+}
+
+//解析一个UDP报文，一个报文就是一个完整消息。UDP消息头沿用主机字节序。
+//长度不符返回-1，否则调用handler(msgid, msglen, data)并返回0
+template<typename HANDLER>
+inline int decode_datagram(const char* pkg, int pkg_len, HANDLER&& handler){
+    if(pkg_len < MESSAGE_HEAD_LEN)
+        return -1;
+
+    int msgid = load_u32(pkg);
+    int msglen = load_u32(pkg + 4);
+    if(!valid_msglen(msglen) || msglen + MESSAGE_HEAD_LEN != pkg_len)
+        return -1;
+
+    handler(msgid, msglen, pkg + MESSAGE_HEAD_LEN);
+    return 0;
+}
@@ -5,6 +5,10 @@ class io_buf{
 public:
     //构造函数，创建一个size大小的buf
     io_buf(int size);
+    //使用外部提供的size大小的内存(大块刻度由buf_arena切出)，析构前由内存池把data取走
+    io_buf(int size, char* mem);
+    //释放内存，只在内存池回收时调用
+    ~io_buf();
     //清空数据
     void clear();
     //处理长度len的数据，并向后移动head
@@ -1,5 +1,6 @@
 #pragma once
 #include <unordered_map>
+#include <vector>
 #include <cstdint>
 #include <functional>
 #include "net_connection.h"
@@ -19,23 +20,113 @@ struct msg_head{
 
 //定义路由回调函数
 using msg_callback = function<void(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data)>;
+//普通函数形式的路由回调。注册的msg_callback里装的是普通函数时取出来直接调用，不经过std::function
+using msg_func = void (*)(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data);
+
+//批量路由中的一个消息
+struct msg_frame{
+    const char* data;
+    uint32_t len;
+};
+
+//批量路由回调：一次读到的同一msgid的连续消息整批交给它(frames[0..count))，
+//回调可以一次加锁处理整批、一起发送回复。frames中的数据只在回调期间有效
+using batch_callback = function<void(const msg_frame* frames, int count, int msgid, net_connection* conn, void* usr_data)>;
+
+//一批最多攒多少个消息
+#define MSG_BATCH_MAX 256
+
+//msgid小于这个值的用数组直接下标查找，更大的或负的放到哈希表中
+#define ROUTER_DENSE_MAX 4096
+
+//一条路由：回调函数和它的形参
+struct msg_route{
+    msg_func fn;            //普通函数，快速路径
+    msg_callback cb;        //其他可调用对象(lambda、bind等)，fn为空时使用
+    batch_callback batch;   //批量路由，非空时fn、cb都为空
+    void* usr_data;
+};
 
 //定义一个消息路由分发机制
 class msg_router{
+    friend class msg_batch;
 public:
-    //构造函数，初始化两个map
+    //构造函数
     msg_router();
 
     //注册msgid到对应回调函数的映射
     int register_msg_router(int msgid, msg_callback msg_cb, void* usr_data);
 
-    //调用对应回调函数
+    //注册msgid到批量路由回调的映射，同一msgid的普通路由被替换
+    int register_batch_router(int msgid, batch_callback batch_cb, void* usr_data);
+
+    //调用对应回调函数。批量路由收到的是只有一个消息的批
     void call(int msgid, uint32_t msglen, const char* data, net_connection* conn);
 
 private:
-    //映射一：msgid到回调函数
-    unordered_map<int, msg_callback> _msgid2router;
-    //映射二：msgid到回调函数形参
-    unordered_map<int, void*> _msgid2args;
+    //保存msgid的路由，已有的被替换
+    void set_route(int msgid, const msg_route& route);
+
+    //msgid对应的路由，未注册返回nullptr
+    const msg_route* find_route(int msgid){
+        if((unsigned)msgid < _dense.size()){
+            const msg_route& route = _dense[msgid];
+            return (route.fn || route.cb || route.batch) ? &route : nullptr;
+        }
+        auto it = _sparse.find(msgid);
+        return it == _sparse.end() ? nullptr : &it->second;
+    }
 
+    //msgid在[0, ROUTER_DENSE_MAX)之间的路由，按msgid下标存放。lars.proto中的msgid都是小整数
+    vector<msg_route> _dense;
+    //其余msgid的路由
+    unordered_map<int, msg_route> _sparse;
+};
+
+//一次读到的消息的分发器，在读回调的栈上创建。
+//批量路由的消息先攒起来，同一msgid连续的消息攒成一批；遇到别的msgid、攒满或flush时整批交给回调。
+//其他消息先把攒着的交出去再直接路由，所以各消息的处理顺序不变。
+//消息数据指向输入缓冲，缓冲pop之前必须flush
+class msg_batch{
+public:
+    msg_batch(msg_router& router, net_connection* conn):
+        _router(router), _conn(conn), _route(nullptr), _msgid(0), _count(0){}
+
+    //分发一个消息
+    void add(int msgid, uint32_t msglen, const char* data){
+        const msg_route* route = _router.find_route(msgid);
+        if(!route || !route->batch){
+            this->flush();
+            if(route && route->fn)
+                route->fn(data, msglen, msgid, _conn, route->usr_data);
+            else
+                _router.call(msgid, msglen, data, _conn);
+            return;
+        }
+
+        if(_count > 0 && msgid != _msgid)
+            this->flush();
+        _route = route;
+        _msgid = msgid;
+        _frames[_count++] = msg_frame{data, msglen};
+        if(_count == MSG_BATCH_MAX)
+            this->flush();
+    }
+
+    //把攒着的一批交给批量路由回调
+    void flush(){
+        if(_count == 0)
+            return;
+        int count = _count;
+        _count = 0;
+        _route->batch(_frames, count, _msgid, _conn, _route->usr_data);
+    }
+
+private:
+    msg_router& _router;
+    net_connection* _conn;
+    const msg_route* _route;    //当前这批的路由
+    int _msgid;
+    int _count;
+    msg_frame _frames[MSG_BATCH_MAX];
 };
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 
 //链接类型的抽象类。
 //Tips: c++所有父类都可以有构造函数（区别Java），但抽象类只能在子类创建对象。
@@ -9,6 +10,26 @@ public:
     //纯虚函数，子类必须重写，父类变为抽象类。
     virtual int conn_write2fd(const char* data, int msglen, int msgid) = 0;
 
+    //输出缓冲中还没写出的字节数
+    virtual int output_length(){
+        return 0;
+    }
+
+    //输出缓冲超过高水位、还没回落到低水位。推送路由等生产者据此限速或丢弃，不要一直往缓冲里堆
+    virtual bool write_blocked(){
+        return false;
+    }
+
+    //空闲检查，由所属loop的时间轮在到期时调用。超时则关闭链接并返回0，否则返回下次检查的时刻(单调时钟ms)
+    virtual uint64_t check_idle(uint64_t now_ms){
+        return 0;
+    }
+
+    //攒写模式下由event_loop在本轮末尾调用，把缓冲的数据写出。返回还没写出的字节数
+    virtual int flush_output(){
+        return 0;
+    }
+
     //虚析构函数，必须，防止基类析构没能析构子类
     virtual ~net_connection() = default;
 
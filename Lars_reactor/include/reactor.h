@@ -1,6 +1,7 @@
 #pragma once
 
 #include "io_buf.h"
+#include "buf_arena.h"
 #include "buf_pool.h"
 #include "reactor_buf.h"
 
@@ -1,7 +1,13 @@
 #pragma once 
+#include <sys/uio.h>
+#include <atomic>
+#include <cstdint>
 #include "io_buf.h"
 #include "buf_pool.h"
 
+//链接输出缓冲默认高水位(字节)。超过后触发高水位Hook，write_blocked()为真
+#define OUTPUT_HIGH_WATER (4 * 1024 * 1024)
+
 //双缓冲策略，封装io_buf类，实现无锁读写竞争。
 //缓冲意义类似buffer_event缓冲区
 
@@ -9,42 +15,122 @@
 class reactor_buf{
 public:
     reactor_buf();
-    ~reactor_buf();
+    virtual ~reactor_buf();
 
     //当前buf有多少有效数据
-    int length();
+    virtual int length();
 
     //将已消费数据弹出
-    void pop(int len);
+    virtual void pop(int len);
 
     //将当前buf清空，并归还到内存池
-    void clear();
+    virtual void clear();
 protected:
     io_buf* _buf;
 };
 
 
+//输入缓冲同样是io_buf链表，_buf为链表头(最早收到的数据)，_tail为链表尾。
+//读fd时用一次readv读进尾部剩余空间和栈上的溢出区，溢出的部分挂成新io_buf，不再申请更大的块把旧数据整体拷贝过去；
+//消费数据只移动head，用完的io_buf直接归还，不再adjust搬移未消费数据。
+//只有一个消息跨了两块io_buf时，peek才把它拷贝成连续的一段。
 class input_buf : public reactor_buf{
 public:
+    input_buf():_tail(nullptr), _length(0), _peer_closed(false){}
+    ~input_buf();
+
+    //链上全部未消费数据的长度
+    int length();
+
+    //弹出已消费的len字节，用完的io_buf归还内存池
+    void pop(int len);
+
+    //清空整条链，归还内存池
+    void clear();
+
     //从一个fd中读取数据到io_buf中，取代read（内核到io层）
-    int read_data(int fd);
+    //drain为true时一直读到EAGAIN(ET模式必须)，否则只读一次。
+    //返回本次读到的字节数，-1为出错。对端是否关闭由peer_closed()判断，返回0不代表关闭。
+    int read_data(int fd, bool drain = false);
+
+    //最近一次read_data是否读到了对端关闭(read返回0)
+    bool peer_closed(){
+        return _peer_closed;
+    }
+
+    //获取当前数据，保证前len字节是连续的(len不能超过length())。
+    //前len字节跨了多块io_buf时拷贝到一块新的io_buf中，这是输入路径上唯一的拷贝
+    const char* peek(int len);
+
+    //链表头io_buf中连续数据的起始地址，len传出其长度。空链返回NULL
+    const char* front(int& len){
+        if(!_buf){
+            len = 0;
+            return NULL;
+        }
+        len = _buf->length;
+        return _buf->data + _buf->head;
+    }
 
-    //获取当前数据
-    const char* data();
+    //已知即将收到一个总长len的消息但还没收全：提前换一块能放下整个消息的io_buf，
+    //把已收到的部分拷贝过去，后续数据直接读进这块的剩余空间，消息收全后peek不用再拼接
+    void reserve(int len);
 
-    //回收已消费数据
-    void adjust();
+    //全局统计：累计读到的字节数、读之后又拷贝的字节数(溢出区搬进io_buf、拼接跨块消息)，传出参数。可在任意线程调用
+    static void get_copy_stats(uint64_t& read_bytes, uint64_t& copied_bytes);
 
+private:
+    //单次readv，返回值同read
+    int read_once(int fd);
+
+    io_buf* _tail;
+    int _length;
+    bool _peer_closed;
+
+    //全局统计，所有链接共用。每次read_data/拼接才更新一次
+    static atomic<uint64_t> _stat_read_bytes;
+    static atomic<uint64_t> _stat_copied_bytes;
 };
 
 
+//输出缓冲是io_buf链表，_buf为链表头(最早写入的数据)，_tail为链表尾。
+//追加数据时尾部不够就挂一个新io_buf，不再申请更大的块把旧数据整体拷贝过去；
+//写fd时用writev把整条链一次交给内核。
 class output_buf : public reactor_buf{
 public:
-    //将一段数据写到io_buf中（业务层到io层）。
+    output_buf():_tail(nullptr), _length(0){}
+    ~output_buf();
+
+    //链上全部未发送数据的长度
+    int length();
+
+    //弹出已发送的len字节，用完的io_buf归还内存池
+    void pop(int len);
+
+    //清空整条链，归还内存池
+    void clear();
+
+    //将一段数据写到io_buf中（业务层到io层）。申请不到内存返回-1，缓冲不变
     int write2buf(const char* data, int dalaten);
 
+    //将一组数据(如消息头+消息体)整体写到io_buf中。申请不到内存返回-1，缓冲不变，不会只进去消息头
+    int write2buf(const struct iovec* iov, int iovcnt);
+
+    //发送一组数据(如消息头+消息体)。缓冲为空时先直接writev给fd，数据不经过缓冲拷贝；
+    //没写完的部分(或缓冲中还有旧数据时的全部)拷贝到缓冲，由write2fd继续发送。
+    //写fd出错也只缓冲，错误留给之后的write2fd处理。
+    //返回0成功；-1缓冲失败，这组数据一个字节都没发也没缓冲；
+    //-2已经写出一部分但剩余的缓冲失败，对端收到的是半个消息，调用方必须关闭链接
+    int send_iov(int fd, const struct iovec* iov, int iovcnt);
+
     //将io_buf中数据写到fd中。取代write（io层到内核）。
+    //一直写到缓冲写空或EAGAIN，返回本次写出的字节数，-1为出错。
     int write2fd(int fd);
-};
 
+private:
+    //跳过前skip字节，剩余数据整体追加到缓冲。申请不到内存返回-1，缓冲不变
+    int append(const struct iovec* iov, int iovcnt, int skip);
 
+    io_buf* _tail;
+    int _length;
+};
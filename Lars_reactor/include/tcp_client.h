@@ -33,6 +33,11 @@ public:
         _router.register_msg_router(msgid, cb, usr_data);
     }
 
+    //添加批量路由，一次读到的同一msgid的连续消息整批交给cb
+    void add_batch_router(int msgid, batch_callback cb, void* usr_data = NULL){
+        _router.register_batch_router(msgid, cb, usr_data);
+    }
+
     //设置连接创建之后的Hook函数。给开发者的API
     void set_conn_start(conn_callback cb, void* args = NULL){
         _conn_start_cb = cb;
@@ -43,12 +48,48 @@ public:
         _conn_close_cb = cb;
         _conn_close_cb_args = args;
     }
+    //设置输出缓冲超过高水位时的Hook函数。给开发者的API
+    void set_high_watermark(conn_callback cb, void* args = NULL){
+        _high_water_cb = cb;
+        _high_water_cb_args = args;
+    }
+    //设置输出缓冲超过高水位后又回落到低水位时的Hook函数。给开发者的API
+    void set_write_complete(conn_callback cb, void* args = NULL){
+        _write_complete_cb = cb;
+        _write_complete_cb_args = args;
+    }
+    //设置输出缓冲高低水位(字节)。默认高水位OUTPUT_HIGH_WATER，低水位0(全部写完)；高水位0为不检查
+    void set_watermark(int high, int low){
+        _high_water = high;
+        _low_water = low;
+    }
+    //设置心跳消息id，与服务器heartbeatMsgid一致。收到该id的消息时自动回一个同id的空消息，不进路由
+    void set_heartbeat(int msgid){
+        _heartbeat_msgid = msgid;
+    }
     //Hook函数相关成员变量。肯定是非静态。
     conn_callback _conn_start_cb;
     void* _conn_start_cb_args;
     conn_callback _conn_close_cb;
     void* _conn_close_cb_args;
+    conn_callback _high_water_cb;
+    void* _high_water_cb_args;
+    conn_callback _write_complete_cb;
+    void* _write_complete_cb_args;
+
+    //输出缓冲长度、是否超过高水位(见net_connection)
+    virtual int output_length(){
+        return _obuf.length();
+    }
+    virtual bool write_blocked(){
+        return _over_high;
+    }
 private:
+    //输出缓冲超过高水位时调用高水位Hook
+    void check_high_water();
+    //超过高水位后回落到低水位时调用写完Hook
+    void check_low_water();
+
     //自身cfd
     int _cfd;
     //归属检测的事件堆
@@ -62,5 +103,12 @@ private:
     socklen_t _saddrlen;
     //消息分发路由
     msg_router _router;
+    //输出缓冲高低水位
+    int _high_water;
+    int _low_water;
+    //输出缓冲超过了高水位，还没回落到低水位
+    bool _over_high;
+    //心跳消息id，0为不处理心跳
+    int _heartbeat_msgid;
 };
 
@@ -13,16 +13,56 @@ public:
     void do_write();
     //主动发送消息的方法
     virtual int conn_write2fd(const char*, int, int);
+    //输出缓冲长度、是否超过高水位(见net_connection)
+    virtual int output_length(){
+        return _obuf.length();
+    }
+    virtual bool write_blocked(){
+        return _over_high;
+    }
+    //攒写模式下本轮末尾由loop调用，一次writev写出_obuf，写不完才挂EPOLLOUT
+    virtual int flush_output();
+    //空闲检查：超时关闭；开了心跳时空闲一半超时时间先发一次心跳
+    virtual uint64_t check_idle(uint64_t now_ms);
     //销毁当前客户端连接
     void destroy_conn();
+    //内存池超过软上限时暂停读：摘掉EPOLLIN，对端发送会被TCP窗口挡住，定时检查是否可以恢复
+    void pause_read();
+    //内存回落到软上限以下后恢复读
+    void resume_read();
+
+    //链接句柄。其他线程用get_loop()->send_to_conn(句柄, ...)向本链接发消息，链接关闭后自动失效
+    conn_id get_conn_id(){
+        return _conn_id;
+    }
+    event_loop* get_loop(){
+        return _loop;
+    }
 private:
+    //输出缓冲超过高水位时调用高水位Hook
+    void check_high_water();
+    //超过高水位后回落到低水位时调用写完Hook
+    void check_low_water();
+
     //当前被动接收的cfd
     int _cfd;
     //当前cfd归属于哪个事件堆检测
     event_loop* _loop;
+    //在_loop链接表中的句柄
+    conn_id _conn_id;
     //输出缓冲区
     output_buf _obuf;
     //输入缓冲区
     input_buf _ibuf;
+    //暂停读时的恢复检查定时器，-1为未暂停
+    int _resume_timer;
+    //已登记到loop的flush列表，本轮末尾会写出
+    bool _flush_pending;
+    //输出缓冲超过了高水位，还没回落到低水位
+    bool _over_high;
+    //最近一次读到数据或写事件写出数据的时刻(loop的iter_ms)
+    uint64_t _last_active;
+    //本次空闲已经发过心跳，收到数据后清除
+    bool _probed;
 };
 
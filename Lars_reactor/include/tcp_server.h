@@ -1,7 +1,8 @@
 #pragma once
 #include <arpa/inet.h>
-#include <mutex>
 #include <memory>
+#include <atomic>
+#include <vector>
 #include "event_loop.h"
 #include "message.h"
 #include "tcp_conn.h"
@@ -11,17 +12,51 @@ class tcp_server{
 public:
     tcp_server(event_loop* loop, const char* ip, uint16_t port);
 
-    //提供创建连接的服务
+    //一个监听套接字及其所在loop。主线程一个，多acceptor模式(reusePort)下每个工作线程一个
+    struct acceptor{
+        tcp_server* server;
+        event_loop* loop;       //在哪个loop上accept。多acceptor模式下新链接直接归属它
+        int lfd;
+        int idle_fd;            //预留fd，fd用光(EMFILE)时释放它来accept并关闭新链接
+        int retry_timer;        //fd用光又没有预留fd时暂停监听，到时恢复的定时器，-1为未暂停
+    };
+
+    //提供创建连接的服务。主线程监听套接字
     void do_accept();
+
+    //在acc上批量accept。单lfd模式分发给线程池，多acceptor模式直接在本线程建立链接
+    void do_accept(acceptor* acc);
     
     ~tcp_server();
 
 private:
-    int _lfd;
-    struct sockaddr_in _caddr;
-    socklen_t _caddrlen;
+    //创建一个绑定到saddr的非阻塞监听套接字，失败直接退出
+    static int create_listen_fd(const struct sockaddr_in& saddr, bool reuse_port);
+
+    //创建监听套接字和预留fd
+    acceptor create_acceptor(event_loop* loop, const struct sockaddr_in& saddr, bool reuse_port);
+    static void close_acceptor(acceptor& acc);
+
+    //从acc->lfd上取一个新链接(非阻塞)，没有新链接(EAGAIN)或无法继续返回-1。
+    //EMFILE时用预留fd拒绝一个链接，返回-2
+    static int accept_fd(acceptor* acc, struct sockaddr_in* caddr);
+
+    //fd用光又没有预留fd可用：lfd暂时摘掉EPOLLIN，ACCEPT_RETRY_MS后再恢复监听
+    static void pause_accept(acceptor* acc);
+    static void resume_accept(event_loop* loop, void* args);
+
+    acceptor _main_acceptor;    //主线程监听套接字，多acceptor模式下lfd为-1
     event_loop* _loop;
 
+    //是否为SO_REUSEPORT多acceptor模式
+    bool _reuse_port;
+
+    //每次唤醒最多accept的链接数，防止建链风暴时一直占着loop
+    int _accept_batch;
+
+    //多acceptor模式下每个工作线程一个，创建后不再变化(地址作为回调参数)
+    std::vector<acceptor> _acceptors;
+
 //===============================消息路由及Hook==============================
 public:
     //路由分发机制句柄
@@ -32,6 +67,11 @@ public:
         _router.register_msg_router(msgid, cb, usr_data);
     }
 
+    //添加批量路由，一次读到的同一msgid的连续消息整批交给cb。给开发者的API
+    void add_batch_router(int msgid, batch_callback cb, void* usr_data = NULL){
+        _router.register_batch_router(msgid, cb, usr_data);
+    }
+
     //设置连接创建之后的Hook函数。给开发者的API
     static void set_conn_start(conn_callback cb, void* args = NULL){
         _conn_start_cb = cb;
@@ -42,25 +82,47 @@ public:
         _conn_close_cb = cb;
         _conn_close_cb_args = args;
     }
+    //设置输出缓冲超过高水位时的Hook函数。给开发者的API
+    static void set_high_watermark(conn_callback cb, void* args = NULL){
+        _high_water_cb = cb;
+        _high_water_cb_args = args;
+    }
+    //设置输出缓冲超过高水位后又回落到低水位(默认0，即全部写完)时的Hook函数。给开发者的API
+    static void set_write_complete(conn_callback cb, void* args = NULL){
+        _write_complete_cb = cb;
+        _write_complete_cb_args = args;
+    }
     //Hook函数相关成员变量
     inline static conn_callback _conn_start_cb = NULL;
     inline static void* _conn_start_cb_args = nullptr;
     inline static conn_callback _conn_close_cb = NULL;
     inline static void* _conn_close_cb_args = nullptr;
+    inline static conn_callback _high_water_cb = NULL;
+    inline static void* _high_water_cb_args = nullptr;
+    inline static conn_callback _write_complete_cb = NULL;
+    inline static void* _write_complete_cb_args = nullptr;
+
+    //每个链接输出缓冲的高低水位(字节)，由配置outputHighWater/outputLowWater(KB)决定。高水位0为不检查
+    inline static int _high_water = 0;
+    inline static int _low_water = 0;
+
+    //空闲超时(ms)，由配置idleTimeout(秒)决定，0为不回收。超时没有任何读写的链接被关闭
+    inline static uint64_t _idle_ms = 0;
+    //心跳消息id，由配置heartbeatMsgid决定，0为不用心跳。
+    //链接空闲一半超时时间后服务器发一个空的心跳消息，对端回一个同id的消息即算活跃。心跳消息不进路由
+    inline static int _heartbeat_msgid = 0;
 
 
-//=====================链接池===================
+//=====================链接计数===================
+//链接本身登记在各自loop的链接表中(event_loop::add_conn)，这里只做全局数量限制，不加锁
 public:
-    //所有函数都设为static
-    inline static tcp_conn** conns = nullptr;    //链接池。全部在线链接。使用数组查找时间复杂度低，用指针则不浪费内存
-    static void increase_conn(int cfd, tcp_conn* conn);     //新增一个链接
-    static void decrease_conn(int cfd);         //删除一个链接
     static void get_conn_num(int& cur_conn);    //获取当前链接数量
+    static bool reserve_conn();                 //accept时占用一个链接名额，已满返回false
+    static void release_conn();                 //链接销毁时归还名额
 
 private:                                            
     inline static int _max_conns = 0;    //当前允许链接的最大数量
-    inline static int _cur_conns = 0;   //当前所管理的链接个数
-    inline static mutex _mutex;         //保护链接池操作的互斥量
+    inline static atomic<int> _cur_conns{0};   //当前所管理的链接个数。多个acceptor线程同时accept，用原子量全局限制
 
 //====================线程池========================
 public:
@@ -6,18 +6,47 @@
 #include "tcp_conn.h"
 #include "event_loop.h"
 
+//新链接分配给哪个工作线程的策略，配置文件[reactor] dispatch = rr | least | iphash
+enum dispatch_policy{
+    DISPATCH_RR,        //轮询
+    DISPATCH_LEAST,     //当前链接数最少的线程
+    DISPATCH_IPHASH,    //按客户端ip哈希，同一ip总是落到同一线程
+};
+
 class thread_pool{
     friend void deal_task(event_loop* loop, int fd, void* args);
 public:
-    //有参构造，初始化池内多少个工作线程
+    //有参构造，初始化池内多少个工作线程。工作线程loop和分配策略按[reactor]配置初始化
     thread_pool(int thread_cnt);
 
     //提供一个获取thread_queue的方法。注意，返回的是消息队列。
     //loop传入工作线程，queue有set_loop方法。主线程只需要推送任务给队列即等于获取一个线程。
-    thread_queue<msg_task>* get_thread();
+    //按分配策略选线程，并把该线程的链接数加一。client_ip为网络字节序，iphash策略使用
+    thread_queue<msg_task>* get_thread(uint32_t client_ip = 0);
+
+    //设置新链接分配策略，只能在主线程调用
+    void set_dispatch(dispatch_policy policy){
+        _policy = policy;
+    }
+
+    //工作线程个数
+    int thread_cnt(){
+        return _thread_cnt;
+    }
+
+    //获取第index个工作线程的loop，可用run_in_loop向它投递任务
+    event_loop* get_loop(int index){
+        return _loops[index].get();
+    }
+
+    //获取每个工作线程当前的链接数(传出参数)
+    void get_conn_counts(std::vector<int>& counts);
 
     //发送一个NEW_TASK类型任务的对外接口。主线程业务层调用poll再调用。
     void send_task(task_callback task_cb, void* args = NULL);
+
+    //获取每个工作线程loop的运行统计(传出参数)
+    void get_loop_stats(std::vector<loop_stats>& stats);
 private:
     //当前thread_queue的集合，指针数组，注意两次初始化到对象
     //避免使用unique_ptr<**>，需手动删除器
@@ -35,5 +64,8 @@ private:
     //获取线程函数用到的index索引
     int _index;
 
+    //新链接分配策略
+    dispatch_policy _policy;
+
     std::vector<unique_ptr<tcp_conn>> _conns;
 };
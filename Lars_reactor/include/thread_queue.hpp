@@ -1,26 +1,31 @@
 #pragma once
 #include <queue>
+#include <atomic>
 #include <pthread.h>
-#include <mutex>
+#include <errno.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <iostream>
 #include "event_loop.h"
-using namespace std;    //queue和mutex都要用
+using namespace std;    //queue和atomic都要用
 
 //设为模版类，以防未来任务内容可能不是msg_task
 //Tips: 模板类头文件不能分开写,编译时代码才实际生成。
+//
+//无锁多生产者单消费者(MPSC)队列：单向链表，生产者只对_tail做一次原子exchange，不加锁；
+//消费者只在工作线程loop中调用recv，独占_head。
+//_evfd只在队列由空变非空时写一次(_notified标志)，同一批任务只有一次系统调用。
 template<typename T>
 class thread_queue{
 public:
     thread_queue();
 
     ~thread_queue();
-    
-    //生产者向队列中加任务（main_thread中调用)
+
+    //生产者向队列中加任务（main_thread中调用，可多线程同时调用)
     void send(const T& task);
 
-    //消费者从队列中取数据，将整个queue返回给上层（传出参数），被_evfd激活的读事件业务函数调用
+    //消费者从队列中取数据，将已到达的任务全部追加到queue中返回给上层（传出参数），被_evfd激活的读事件业务函数调用
     void recv(queue<T>& queue);
 
     //设置当前thread_queue被哪个loop监听。loop传入至工作线程，完成绑定。
@@ -38,15 +43,23 @@ public:
     }
 
 private:
+    //链表节点。_head始终指向一个已被消费的哨兵节点，真正的任务从_head->next开始
+    struct node{
+        atomic<node*> next;
+        T data;
+    };
+
     int _evfd;          //事件通知描述符,一个计数器，有新任务时通知工作线程及时处理。和socket无关。
     event_loop* _loop;    //该队列被哪个loop监听。每个工作线程都有一个loop
-    queue<T> _queue;    //队列。deque的适配器，用push和pop, 函数名不同
-    mutex _mutex;       //保护queue的互斥锁。生产者消费者都可能动队列，不能只看生产者。
+    node* _head;            //消费者端，只有工作线程访问
+    atomic<node*> _tail;    //生产者端，新节点exchange到这里
+    atomic<bool> _notified; //已写过_evfd且消费者还未取走，为true时生产者不再写
 };
 
 
 template<typename T>
-thread_queue<T>::thread_queue():_loop(nullptr),_queue(),_mutex(){
+thread_queue<T>::thread_queue():_loop(nullptr),_head(new node()),_tail(_head),_notified(false){
+    _head->next.store(nullptr, memory_order_relaxed);
     _evfd = eventfd(0, EFD_NONBLOCK);
     if(_evfd == -1){
         cerr << "Init evfd error." << endl;
@@ -57,17 +70,29 @@ thread_queue<T>::thread_queue():_loop(nullptr),_queue(),_mutex(){
 template<typename T>
 thread_queue<T>::~thread_queue(){
     close(_evfd);
-    //mutex自动析构。Tips: pthread的锁需要destroy
+    //释放哨兵和未被取走的节点
+    while(_head){
+        node* next = _head->next.load(memory_order_relaxed);
+        delete _head;
+        _head = next;
+    }
 }
 
 template<typename T>
 //生产者向队列中加任务（main_thread中调用)
 void thread_queue<T>::send(const T& task){
-    lock_guard<mutex> lock(_mutex);
-    //将task加入队列中
-    _queue.push(task);
+    node* n = new node();
+    n->next.store(nullptr, memory_order_relaxed);
+    n->data = task;
+
+    //1. 抢到队尾，再把前一个节点接上。两步之间消费者看到的链表暂时断开，接上前的任务留给下次recv
+    node* prev = _tail.exchange(n, memory_order_acq_rel);
+    prev->next.store(n, memory_order_release);
+
+    //2. 只有由空变非空(消费者已取走上次通知)时才写_evfd，激活工作线程loop可读事件
+    if(_notified.exchange(true, memory_order_acq_rel))
+        return;
 
-    //向_evfd写数据以激活工作线程loop可读事件
     uint64_t evfd_sig = 1;      //必须这个类型，eventfd要求。不在意跨系统可以用unsigned long long
     int ret = write(_evfd, &evfd_sig, sizeof(evfd_sig));
     if(ret == -1)
@@ -75,24 +100,25 @@ void thread_queue<T>::send(const T& task){
 }
 
 template<typename T>
-//消费者从队列中取数据，将整个queue返回给上层（传出参数），被_evfd激活的读事件业务函数调用
+//消费者从队列中取数据，将已到达的任务追加到queue中（传出参数），被_evfd激活的读事件业务函数调用
 void thread_queue<T>::recv(queue<T>& queue_copy){
-    lock_guard<mutex> lock(_mutex);
-    
+    //通知已被取走。非阻塞evfd没有计数时返回EAGAIN，说明本批任务已被上次recv一起取走，不是错误
     uint64_t evfd_sig = 0;
     int ret = read(_evfd, &evfd_sig, sizeof(evfd_sig));
-    if(ret == -1){
+    if(ret == -1 && errno != EAGAIN){
         cerr << "Evfd read error."<< endl;
         return;
     }
 
-    //取出queue操作，通过交换实现。原子操作，并且避免thread_queue阻塞不接收新任务
-    swap(queue_copy, _queue);
-    //copy(queue_copy, _queue);也可以，但性能没有前者好。
-}
-
-
-
-
-
+    //先清标志再取任务：清之后才挂上的任务，生产者会重新写_evfd，不会漏掉
+    _notified.exchange(false, memory_order_acq_rel);
 
+    //沿链表取出全部已接好的节点，旧哨兵释放，最后一个取出的节点成为新哨兵
+    node* next = _head->next.load(memory_order_acquire);
+    while(next){
+        queue_copy.push(std::move(next->data));
+        delete _head;
+        _head = next;
+        next = _head->next.load(memory_order_acquire);
+    }
+}
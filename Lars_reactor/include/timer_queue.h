@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+using namespace std;
+
+//定时器子系统：最小堆，堆顶为最早到期的定时器。
+//event_loop用堆顶时间计算epoll_wait超时，不再固定100ms轮询。
+
+class event_loop;
+
+//定时器回调类型，与异步任务回调一致
+using timer_callback = void (*)(event_loop* loop, void* args);
+
+//一个定时器的完整信息
+struct timer_event{
+    uint64_t expire;        //到期时间，单调时钟ms
+    uint64_t interval;      //重复间隔ms，0表示只执行一次
+    timer_callback cb;
+    void* args;
+};
+
+class timer_queue{
+public:
+    timer_queue();
+
+    //添加一个定时器，返回定时器id(>0)
+    int add_timer(uint64_t expire, uint64_t interval, timer_callback cb, void* args);
+
+    //删除一个定时器。堆中节点延迟删除，弹出时跳过
+    void del_timer(int timer_id);
+
+    //距离最早到期还有多少ms，没有定时器返回-1
+    int next_timeout(uint64_t now);
+
+    //执行所有已到期的定时器，重复定时器重新入堆
+    void run_expired(event_loop* loop, uint64_t now);
+
+    //当前有效定时器个数
+    int size(){
+        return _timers.size();
+    }
+
+    //当前单调时钟，ms
+    static uint64_t now_ms();
+
+private:
+    //堆节点只存到期时间和id，定时器本身在_timers中，删除时只删_timers
+    struct heap_node{
+        uint64_t expire;
+        int id;
+        bool operator>(const heap_node& other) const{
+            return expire > other.expire;
+        }
+    };
+
+    //堆中已删除节点过多时重建堆，防止频繁取消(如空闲超时重置)导致堆无限增长
+    void rebuild_heap();
+
+    vector<heap_node> _heap;
+    unordered_map<int, timer_event> _timers;
+    int _next_id;
+};
@@ -0,0 +1,91 @@
+#include "buf_arena.h"
+#include <sys/mman.h>
+#include <stdint.h>
+#include <iostream>
+using namespace std;
+
+buf_arena::buf_arena():_cur(nullptr), _end(nullptr), _free_kb(0), _huge(false){
+}
+
+//映射一片新的区域，起始地址按大页对齐
+bool buf_arena::map_region(){
+    //多映射一个大页的长度，截掉头尾不对齐的部分
+    size_t len = ARENA_REGION_SIZE + ARENA_HUGE_PAGE;
+    char* raw = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED){
+        cerr << "Mmap arena region error." << endl;
+        return false;
+    }
+
+    char* start = (char*)(((uintptr_t)raw + ARENA_HUGE_PAGE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+    if(start > raw)
+        munmap(raw, start - raw);
+    char* end = start + ARENA_REGION_SIZE;
+    if(raw + len > end)
+        munmap(end, raw + len - end);
+
+    //内核不支持透明大页时返回EINVAL，用普通页即可
+    if(madvise(start, ARENA_REGION_SIZE, MADV_HUGEPAGE) == 0)
+        _huge = true;
+
+    _regions.push_back(start);
+    _cur = start;
+    _end = end;
+    return true;
+}
+
+//切一块cap大小的内存
+char* buf_arena::alloc(int cap){
+    //1. 先复用同刻度归还的
+    for(auto& fl : _free_lists){
+        if(fl.first == cap && !fl.second.empty()){
+            char* p = fl.second.back();
+            fl.second.pop_back();
+            _free_kb -= cap/1024;
+            return p;
+        }
+    }
+
+    //2. 从当前区域切。按min(cap, 大页)对齐，大块尽量落在整的大页上
+    uintptr_t align = cap < ARENA_HUGE_PAGE ? cap : ARENA_HUGE_PAGE;
+    char* p = _cur ? (char*)(((uintptr_t)_cur + align - 1) & ~(align - 1)) : nullptr;
+    if(!p || p + cap > _end){
+        //当前区域剩下的尾巴不够一块，放弃，映射新区域
+        if(!map_region())
+            return nullptr;
+        p = _cur;
+    }
+    _cur = p + cap;
+    return p;
+}
+
+//归还一块内存
+void buf_arena::revert(char* p, int cap){
+    madvise(p, cap, MADV_DONTNEED);
+
+    for(auto& fl : _free_lists){
+        if(fl.first == cap){
+            fl.second.push_back(p);
+            _free_kb += cap/1024;
+            return;
+        }
+    }
+    _free_lists.push_back({cap, vector<char*>(1, p)});
+    _free_kb += cap/1024;
+}
+
+//p是否是从本分配区切出的
+bool buf_arena::owns(const char* p){
+    for(char* start : _regions){
+        if(p >= start && p < start + ARENA_REGION_SIZE)
+            return true;
+    }
+    return false;
+}
+
+void buf_arena::get_stats(arena_stat& stat){
+    stat.regions = _regions.size();
+    stat.mapped_kb = (uint64_t)_regions.size() * (ARENA_REGION_SIZE/1024);
+    stat.free_kb = _free_kb;
+    stat.huge = _huge;
+}
@@ -1,119 +1,368 @@
 #include "buf_pool.h"
+#include "event_loop.h"
+#include "config_file.h"
+#include <sstream>
 #include <iostream>
+#include <malloc.h>
 using namespace std;
 
 buf_pool* buf_pool:: _instance = nullptr;
 mutex buf_pool::_mutex;
 once_flag buf_pool::_once_flag;
 
+//各刻度，下标即刻度下标
+static const int g_caps[MEM_CLASS_NUM] = {m4K, m16K, m64K, m256K, m1M, m4M, m8M};
+
+//刻度下标，超过最大刻度返回-1
+static int class_index(int N){
+    for(int i = 0; i < MEM_CLASS_NUM; ++i){
+        if(N <= g_caps[i])
+            return i;
+    }
+    return -1;
+}
+
+//线程缓存每次和总内存池交换的块数：小块多拿，大块少拿，一批不超过256KB(至少1块)
+static int batch_size(int idx){
+    int n = m256K / g_caps[idx];
+    if(n > 64)  n = 64;
+    return n > 0 ? n : 1;
+}
+
+//=================================================================================
+//线程缓存。每个线程一份(每个event_loop线程一份)，常见的申请/归还只在本线程的链表上操作，不加锁。
+//缓存空了从总内存池批量补货，缓存超过两批就把一批还回总内存池，都只在这时加一次锁。
+struct thread_cache{
+    io_buf* head[MEM_CLASS_NUM];
+    int count[MEM_CLASS_NUM];
+    //本线程尚未汇总的统计
+    uint64_t allocs[MEM_CLASS_NUM];
+    uint64_t misses[MEM_CLASS_NUM];
+
+    thread_cache(){
+        for(int i = 0; i < MEM_CLASS_NUM; ++i){
+            head[i] = nullptr;
+            count[i] = allocs[i] = misses[i] = 0;
+        }
+    }
+
+    //线程退出，缓存全部还回总内存池
+    ~thread_cache(){
+        buf_pool* pool = buf_pool::get_instance();
+        for(int i = 0; i < MEM_CLASS_NUM; ++i){
+            if(head[i]){
+                io_buf* last = head[i];
+                while(last->next)   last = last->next;
+                pool->spill_batch(i, head[i], last, count[i]);
+                head[i] = nullptr;
+                count[i] = 0;
+            }
+            flush_stats(i);
+        }
+    }
+
+    io_buf* alloc(int idx){
+        ++allocs[idx];
+        if(!head[idx]){
+            //缓存空了，批量补货
+            ++misses[idx];
+            flush_stats(idx);
+            int n = batch_size(idx);
+            head[idx] = buf_pool::get_instance()->fetch_batch(idx, n);
+            if(!head[idx])
+                return nullptr;     //到了硬上限
+            count[idx] = n;
+        }
+
+        io_buf* target = head[idx];
+        head[idx] = target->next;
+        --count[idx];
+
+        target->next = nullptr;
+        return target;
+    }
+
+    void revert(int idx, io_buf* buffer){
+        buffer->next = head[idx];
+        head[idx] = buffer;
+        ++count[idx];
+
+        //缓存太多，把最近归还的一批之后的部分还回总内存池，本线程保留一批
+        int n = batch_size(idx);
+        if(count[idx] >= 2 * n){
+            io_buf* keep_last = head[idx];
+            for(int i = 1; i < n; ++i)
+                keep_last = keep_last->next;
+            io_buf* first = keep_last->next;
+            io_buf* last = first;
+            while(last->next)   last = last->next;
+            keep_last->next = nullptr;
+            int spill = count[idx] - n;
+            count[idx] = n;
+
+            flush_stats(idx);
+            buf_pool::get_instance()->spill_batch(idx, first, last, spill);
+        }
+    }
+
+    //本线程的统计汇总到总内存池
+    void flush_stats(int idx){
+        buf_pool* pool = buf_pool::get_instance();
+        if(allocs[idx]){
+            pool->_allocs[idx].fetch_add(allocs[idx], memory_order_relaxed);
+            allocs[idx] = 0;
+        }
+        if(misses[idx]){
+            pool->_misses[idx].fetch_add(misses[idx], memory_order_relaxed);
+            misses[idx] = 0;
+        }
+    }
+};
+
+static thread_local thread_cache t_cache;
+
+//=================================================================================
 //初始化pool池复用
 void buf_pool::make_io_buf_list(int cap, int num){
-    //用于创建内存链表的指针
-    io_buf* pcur;
-
-    //创建头节点
-    _pool[cap] = new io_buf(cap);
-    if(!_pool[cap]){
-        cerr << "New io_buf " << cap << " create error."<< endl;
-        exit(1);
-    }
-    
-    _mem_capacity += cap/1024;
-    pcur = _pool[cap];
-
-    //循环开辟后续节点
-    for(int i = 1; i < num; ++i){
-        pcur->next = new io_buf(cap);
-        if(!_pool[cap]){
-            cerr << "New io_buf " << cap << " create error."<< endl;
-            exit(1);
-        }
-        pcur = pcur->next;
+    int idx = class_index(cap);
+
+    //头插num个节点
+    for(int i = 0; i < num; ++i){
+        io_buf* buf = new_buf(idx);
+        buf->next = _pool[idx];
+        _pool[idx] = buf;
         _mem_capacity += cap/1024;
     }
+    _free_cnt[idx] += num;
+    _min_free[idx] = _free_cnt[idx];
+    _cached_kb += (uint64_t)num * (cap/1024);
+    update_used();
 }
 
-//构造函数
-buf_pool::buf_pool():_mem_capacity(0){
-    make_io_buf_list(m4K, 5000);
-    make_io_buf_list(m16K, 1000);
-    make_io_buf_list(m64K, 500);
-    make_io_buf_list(m256K,200);
-    make_io_buf_list(m1M, 50);
-    make_io_buf_list(m4M, 20);
-    make_io_buf_list(m8M, 10);
+//构造函数。不预分配，按需申请；需要预热的服务在配置中指定bufPoolInit
+buf_pool::buf_pool():_use_arena(true), _configured(false), _mem_capacity(0), _cached_kb(0), _used_kb(0),
+    _soft_limit_kb(MEM_LIMIT / 5 * 4), _hard_limit_kb(MEM_LIMIT), _alloc_fails(0){
+    for(int i = 0; i < MEM_CLASS_NUM; ++i){
+        _pool[i] = nullptr;
+        _free_cnt[i] = _min_free[i] = _low_water[i] = 0;
+        _allocs[i] = 0;
+        _misses[i] = 0;
+    }
 }
 
-//申请一块内存
-io_buf*  buf_pool::alloc_buf(int N){
-    int index = [&]()->int {        // lambda所有的返回类型必须一致,int不能隐式转换为MEM_CAP枚举类型
-        if (N <= m4K)        return m4K;
-        else if (N <= m16K)  return m16K;
-        else if (N <= m64K)  return m64K;
-        else if (N <= m256K) return m256K;
-        else if (N <= m1M)   return m1M;
-        else if (N <= m4M)   return m4M;
-        else if (N <= m8M)   return m8M;
-        else                 return 0; 
-    }();  //注意最后(),因为lambda生成的是重载了operator()的匿名类，是仿函数还未执行。
-
-    if (index == 0) return nullptr;  // 处理无效输入
-
-    unique_lock<mutex> lock(_mutex);    
-    
-    //2.如果该刻度的内存链表已经用完，额外申请内存
-    if(_pool[index] == NULL){
-        if(_mem_capacity + index/1024 >= MEM_LIMIT){
-            cerr << "Already too much memory used." << endl;
-            exit(1);
-        }
+//定时回收
+static void trim_callback(event_loop* loop, void* args){
+    buf_pool::get_instance()->trim();
+}
 
-        io_buf* new_buf = new io_buf(index);
-        if(!new_buf){
-            cerr << "New io_buf " << index << " create error."<< endl;
-            exit(1);
-        }
+//按配置预分配、设置低水位，启动定时回收
+void buf_pool::load_config(event_loop* loop){
+    {
+        unique_lock<mutex> lock(_mutex);
+        if(_configured)
+            return;
+        _configured = true;
+
+        //大块刻度是否从大页分配区切。要在预分配之前设置
+        _use_arena = config_file::instance()->GetBool("reactor", "bufPoolHugeArena", true);
+
+        //"4K:512,16K:64"
+        stringstream ss(config_file::instance()->GetString("reactor", "bufPoolInit", ""));
+        string item;
+        while(getline(ss, item, ',')){
+            size_t colon = item.find(':');
+            if(colon == string::npos)
+                continue;
+            int cap = atoi(item.c_str()) * 1024;
+            if(item.find('M') < colon)
+                cap *= 1024;
+            int num = atoi(item.c_str() + colon + 1);
 
-        _mem_capacity += index/1024;
-        //不用手动解锁
-        return new_buf;
+            int idx = class_index(cap);
+            if(idx == -1 || g_caps[idx] != cap || num <= 0){
+                cerr << "Invalid bufPoolInit item: " << item << endl;
+                continue;
+            }
+            make_io_buf_list(cap, num);
+            _low_water[idx] = num;
+        }
     }
 
-    //3.如果该刻度有内存，从pool中取一块内存返回
-    io_buf* target = _pool[index];
-    _pool[index] = target->next;
+    //软硬上限，MB。软上限默认硬上限的80%
+    uint64_t hard_mb = config_file::instance()->GetNumber("reactor", "bufPoolHardLimit", MEM_LIMIT / 1024);
+    uint64_t soft_mb = config_file::instance()->GetNumber("reactor", "bufPoolSoftLimit", hard_mb / 5 * 4);
+    if(soft_mb > hard_mb)
+        soft_mb = hard_mb;
+    {
+        unique_lock<mutex> lock(_mutex);
+        _hard_limit_kb = hard_mb * 1024;
+        _soft_limit_kb = soft_mb * 1024;
+    }
 
-    target->next = nullptr;
-    return target;
+    int trim_sec = config_file::instance()->GetNumber("reactor", "bufPoolTrimSec", 60);
+    if(trim_sec > 0)
+        loop->run_every(trim_sec * 1000, trim_callback);
 }
 
-//将一个io_buf放回pool中
-void buf_pool::revert(io_buf* buffer){
-    //属于哪个内存链表
-    int index = buffer->capacity;
+//回收一直空闲且超过低水位的块
+void buf_pool::trim(){
+    bool released = false;
+    {
+        unique_lock<mutex> lock(_mutex);
+        for(int idx = 0; idx < MEM_CLASS_NUM; ++idx){
+            //整个周期都没被取走的块数，最多释放到低水位
+            int release = _min_free[idx];
+            if(_free_cnt[idx] - release < _low_water[idx])
+                release = _free_cnt[idx] - _low_water[idx];
 
-    buffer->head = buffer->length = 0;
+            if(release > 0){
+                //链表头是最近归还的，保留；从尾部释放
+                int keep = _free_cnt[idx] - release;
+                io_buf** pcur = &_pool[idx];
+                for(int i = 0; i < keep; ++i)
+                    pcur = &(*pcur)->next;
 
-    unique_lock<mutex> lock(_mutex);
+                io_buf* cur = *pcur;
+                *pcur = nullptr;
+                while(cur){
+                    io_buf* next = cur->next;
+                    delete_buf(cur);
+                    cur = next;
+                }
 
-    //未找到这个key
-    if(_pool.find(index) == _pool.end()){
+                _free_cnt[idx] = keep;
+                _mem_capacity -= (uint64_t)release * (g_caps[idx]/1024);
+                _cached_kb -= (uint64_t)release * (g_caps[idx]/1024);
+                released = true;
+            }
+            _min_free[idx] = _free_cnt[idx];
+        }
+        update_used();
+    }
+
+    //小块在malloc的堆上，释放后还要trim才会还给系统；大块(mmap)delete时已经还了
+    if(released)
+        malloc_trim(0);
+}
+
+//申请一块内存，先从本线程缓存拿
+io_buf*  buf_pool::alloc_buf(int N){
+    int idx = class_index(N);
+    if (idx == -1) return nullptr;  // 处理无效输入
+
+    return t_cache.alloc(idx);
+}
+
+//将一个io_buf放回本线程缓存
+void buf_pool::revert(io_buf* buffer){
+    //属于哪个内存链表
+    int idx = class_index(buffer->capacity);
+    if(idx == -1 || g_caps[idx] != buffer->capacity){
         cerr << "No such type io_buf" << endl;
         return;
     }
 
-    buffer->next = _pool[index];
-    _pool[index] = buffer;
-    buffer = nullptr;
+    buffer->head = buffer->length = 0;
+    t_cache.revert(idx, buffer);
 }
 
+//从总内存池批量取n块，不够的额外申请，到硬上限为止
+io_buf* buf_pool::fetch_batch(int idx, int& n){
+    int cap = g_caps[idx];
+    io_buf* first = nullptr;
+    int got = 0;
 
+    unique_lock<mutex> lock(_mutex);
+    for(; got < n; ++got){
+        io_buf* target = _pool[idx];
+        if(target){
+            _pool[idx] = target->next;
+            --_free_cnt[idx];
+            _cached_kb -= cap/1024;
+        }
+        else{
+            //该刻度的内存链表已经用完，额外申请内存。
+            //到了硬上限不再申请，由调用方处理(读暂停/断开该链接)，不退出进程
+            if(_mem_capacity + cap/1024 > _hard_limit_kb){
+                if(got == 0)
+                    _alloc_fails.fetch_add(1, memory_order_relaxed);
+                break;
+            }
 
+            target = new_buf(idx);
+            _mem_capacity += cap/1024;
+        }
+        target->next = first;
+        first = target;
+    }
+    if(_free_cnt[idx] < _min_free[idx])
+        _min_free[idx] = _free_cnt[idx];
+    update_used();
+    //不用手动解锁
 
+    n = got;
+    return first;
+}
 
+//向系统申请一块内存。1M及以上刻度从分配区切，映射失败退回new
+io_buf* buf_pool::new_buf(int idx){
+    int cap = g_caps[idx];
+    if(_use_arena && cap >= m1M){
+        char* mem = _arena.alloc(cap);
+        if(mem)
+            return new io_buf(cap, mem);
+    }
+    return new io_buf(cap);
+}
 
+//释放一块内存还给系统
+void buf_pool::delete_buf(io_buf* buf){
+    if(_arena.owns(buf->data)){
+        _arena.revert(buf->data, buf->capacity);
+        buf->data = nullptr;
+    }
+    delete buf;
+}
 
+//一串内存还回总内存池
+void buf_pool::spill_batch(int idx, io_buf* first, io_buf* last, int n){
+    unique_lock<mutex> lock(_mutex);
+    last->next = _pool[idx];
+    _pool[idx] = first;
+    _free_cnt[idx] += n;
+    _cached_kb += (uint64_t)n * (g_caps[idx]/1024);
+    update_used();
+}
 
+//加锁修改_mem_capacity或_cached_kb后调用
+void buf_pool::update_used(){
+    _used_kb.store(_mem_capacity - _cached_kb, memory_order_relaxed);
+}
 
+//整体用量
+void buf_pool::get_mem_stats(buf_mem_stat& stat){
+    unique_lock<mutex> lock(_mutex);
+    stat.total_kb = _mem_capacity;
+    stat.cached_kb = _cached_kb;
+    stat.used_kb = _mem_capacity - _cached_kb;
+    stat.soft_limit_kb = _soft_limit_kb.load(memory_order_relaxed);
+    stat.hard_limit_kb = _hard_limit_kb;
+    stat.alloc_fails = _alloc_fails.load(memory_order_relaxed);
+}
 
+//各刻度统计
+void buf_pool::get_stats(vector<buf_class_stat>& stats){
+    stats.clear();
+    unique_lock<mutex> lock(_mutex);
+    for(int i = 0; i < MEM_CLASS_NUM; ++i){
+        uint64_t allocs = _allocs[i].load(memory_order_relaxed);
+        uint64_t misses = _misses[i].load(memory_order_relaxed);
+        stats.push_back({g_caps[i], allocs, allocs - misses, _free_cnt[i]});
+    }
+}
 
+//大块分配区统计
+void buf_pool::get_arena_stats(arena_stat& stat){
+    unique_lock<mutex> lock(_mutex);
+    _arena.get_stats(stat);
+}
@@ -1,72 +1,198 @@
 #include "event_loop.h"
+#include "net_connection.h"
+#include "thread_queue.hpp"
+#include "config_file.h"
 #include <iostream>
+#include <string>
+#include <ctime>
+#include <algorithm>
+#include <sys/resource.h>
 
-event_loop::event_loop(){
+event_loop::event_loop():
+    _edge_trigger(false),
+    _ptr_dispatch(false),
+    _write_cork(false),
+    _batch_no(0),
+    _fired_evs(EPOLL_BATCH_INIT),
+    _stat_waits(0), _stat_events(0), _stat_full_waits(0), _stat_iters_per_sec(0),
+    _stat_batch_size(EPOLL_BATCH_INIT), _conn_cnt(0),
+    _stat_flushes(0), _stat_flush_blocked(0),
+    _stat_sec(time(NULL)), _stat_iters(0),
+    _iter_ms(now_ms()), _idle_sec(0), _idle_timer(-1),
+    _owner(), _owned(false)
+{
     if((_epfd = epoll_create(999)) == -1){
         fprintf(stderr, "Epoll create error.\n");
         exit(1);
     }
+
+    //收件箱的eventfd挂到本loop上
+    _inbox = make_unique<thread_queue<task_func>>();
+    _inbox->set_loop(this);
+    _inbox->set_callback(do_inbox, this);
+}
+
+//thread_queue在头文件中只有前置声明，析构必须放在这里
+event_loop::~event_loop(){
+    close(_epfd);
 }
 
 //循环阻塞监听事件，并处理。事件堆自己调用。                                                                                                 
 void event_loop::event_process(){
+    //获取线程名称。放在循环外，每轮都取会多一次系统调用
+    char thread_name[16];
+    pthread_getname_np(pthread_self(), thread_name, size(thread_name));
+
+    //从这里开始本loop归属当前线程
+    _owner = pthread_self();
+    _owned.store(true, memory_order_release);
+
     while(1){
         //cout << "==============================Waiting IO event...=================================" << endl;
-        //获取线程名称
-        char thread_name[16];
-        pthread_getname_np(pthread_self(), thread_name, size(thread_name));
-
         //测试时便于观察
-        //cerr << "Thread " << thread_name << " is monitoring " << _listen_fds.size() << " counts of fds: " << endl;;
-        //for(int x : _listen_fds)    
+        //listen_fds fds;
+        //get_listen_fds(fds);
+        //cerr << "Thread " << thread_name << " is monitoring " << fds.size() << " counts of fds: " << endl;;
+        //for(int x : fds)    
         //    cout << "fd" << x << "is being listened." << endl;
 
-        int nfds = epoll_wait(_epfd, _fired_evs, MAX_EVENTS, 100);   //nubmer of file descriptors.传出到_fired_evs
-        //timeout设为100防止阻塞无法执行异步任务
+        //超时时间由最近的定时器决定，没有定时器就一直阻塞(-1)。
+        //还有未执行的异步任务、或有待flush的链接(event_process启动前攒下的)时不阻塞。
+        int timeout = _ready_tasks.empty() && _flush_list.empty() ? _timers.next_timeout(now_ms()) : 0;
+
+        int nfds = epoll_wait(_epfd, _fired_evs.data(), _fired_evs.size(), timeout);   //nubmer of file descriptors.传出到_fired_evs
+        _iter_ms = now_ms();
+
+        //统计。每秒刷新一次循环次数
+        _stat_waits.fetch_add(1, memory_order_relaxed);
+        if(nfds > 0)
+            _stat_events.fetch_add(nfds, memory_order_relaxed);
+        ++_stat_iters;
+        time_t now = time(NULL);
+        if(now != _stat_sec){
+            _stat_iters_per_sec.store(_stat_iters / (now - _stat_sec), memory_order_relaxed);
+            _stat_sec = now;
+            _stat_iters = 0;
+        }
+        //本轮分发编号。本轮中被删除的handler记下编号，之后本轮指向它的事件都跳过
+        uint64_t batch = ++_batch_no;
+        //本轮开始时handler数组的首地址。回调中注册更大的fd可能导致数组搬家
+        event_handler* batch_base = _handlers.data();
+
         for(int i = 0; i < nfds; ++i){
-            //从map映射中找到对应事件逻辑
-            auto it = _fd2handler.find(_fired_evs[i].data.fd);
-            event_handler* hdl = &(it->second);
-            
-            if(_fired_evs[i].events & EPOLLIN){     //读事件
-                void* args = hdl->rcb_args;
-                hdl->read_callback(this, _fired_evs[i].data.fd, args);
+            uint32_t revents = _fired_evs[i].events;
+            event_handler* hdl;
+            int fd;
+
+            if(_ptr_dispatch){
+                //指针模式：data.ptr就是handler，无需查表
+                hdl = (event_handler*)_fired_evs[i].data.ptr;
+                if(_handlers.data() != batch_base)      //本轮中数组搬家(极少见)，按偏移换算到新数组
+                    hdl = &_handlers[((uintptr_t)hdl - (uintptr_t)batch_base) / sizeof(event_handler)];
+                fd = hdl->fd;
             }
-            else if (_fired_evs[i].events & EPOLLOUT){     //写事件
-                void* args = hdl->wcb_args;
-                hdl->write_callback(this, _fired_evs[i].data.fd, args);
+            else{
+                //按fd下标直接取对应事件逻辑
+                fd = _fired_evs[i].data.fd;
+                hdl = &_handlers[fd];
+            }
+
+            //本轮前面的回调可能已经把它删掉了(如destroy_conn)，即使fd又被新链接复用，这个事件也是旧的
+            if(hdl->del_batch == batch || !(hdl->mask & (EPOLLIN | EPOLLOUT)))
+                continue;
+            if(revents & (EPOLLIN | EPOLLOUT)){
+                //读写可能同时就绪。ET模式下边沿只通知一次，读写都要在这一轮处理，不能只处理一个。
+                if((revents & EPOLLIN) && hdl->read_callback != NULL){     //读事件
+                    void* args = hdl->rcb_args;
+                    hdl->read_callback(this, fd, args);
+                }
+
+                if(revents & EPOLLOUT){     //写事件
+                    //读回调中可能已销毁链接(del_io_event)，或注册新fd导致数组扩容，hdl会失效，重新取
+                    hdl = &_handlers[fd];
+                    if(hdl->del_batch == batch || !(hdl->mask & EPOLLOUT))
+                        continue;
+                    void* args = hdl->wcb_args;
+                    hdl->write_callback(this, fd, args);
+                }
             }
-            else if(_fired_evs[i].events & (EPOLLHUP | EPOLLERR)){  
+            else if(revents & (EPOLLHUP | EPOLLERR)){  
                 //链接挂断、异常崩溃
                 //读写，确保不丢包+确认错误类型(0/-1?)
                 if(hdl->read_callback != NULL){
                     void* args = hdl->rcb_args;
-                    hdl->read_callback(this, _fired_evs[i].data.fd, args);
+                    hdl->read_callback(this, fd, args);
                 }
                 else if(hdl->write_callback != NULL){
                     void* args = hdl->wcb_args;
-                    hdl->write_callback(this, _fired_evs[i].data.fd, args);
+                    hdl->write_callback(this, fd, args);
                 }else{      //读写掩码都没有，删除
-                    cout << "Fd" << _fired_evs[i].data.fd << " :all mask cleared, delete from epoll." << endl;
-                    this->del_io_event(_fired_evs[i].data.fd);
+                    cout << "Fd" << fd << " :all mask cleared, delete from epoll." << endl;
+                    this->del_io_event(fd);
                 }
             }
         }
+        //一次取满说明还有积压的就绪事件，数组翻倍，下一轮一次取回更多
+        if(nfds == (int)_fired_evs.size()){
+            _stat_full_waits.fetch_add(1, memory_order_relaxed);
+            if(_fired_evs.size() < EPOLL_BATCH_MAX){
+                _fired_evs.resize(_fired_evs.size() * 2);
+                _stat_batch_size.store(_fired_evs.size(), memory_order_relaxed);
+            }
+        }
+
+        //执行到期的定时器
+        if(_timers.size() > 0)
+            _timers.run_expired(this, _iter_ms);
+
         //每次执行完主要io任务后，执行一些其他任务
         //这里是客户端实际执行任务。主线程仅负责推送msg_task，任务由客户端自己管理。
         this->execute_ready_tasks();
+
+        //最后把本轮攒下的输出一次写出
+        if(!_flush_list.empty())
+            this->flush_pending();
     }
 }
 
+//本轮末尾flush全部登记的链接
+void event_loop::flush_pending(){
+    _flushing.swap(_flush_list);
+    for(conn_id id : _flushing){
+        //登记后链接已关闭，句柄失效
+        net_connection* conn = this->get_conn(id);
+        if(!conn)
+            continue;
+
+        _stat_flushes.fetch_add(1, memory_order_relaxed);
+        if(conn->flush_output() > 0)
+            _stat_flush_blocked.fetch_add(1, memory_order_relaxed);
+    }
+    _flushing.clear();
+}
+
 //添加一个io事件到事件堆中，或添加一个事件位掩码到已有事件中。
 void event_loop::add_io_event(int fd, io_callback* io_cb, int mask, void* args){
     int final_mask;
     int op;
     //Tips: 使用mod，event字段会覆盖原先的字段。原生epoll_event不需要保存，上树即可。
 
-    //1.映射中检测当前fd是否已有事件，得到op操作方式。
-    auto it = _fd2handler.find(fd);
-    if(it == _fd2handler.end()){
+    if(fd < 0){
+        cerr << "Add io event with invalid fd " << fd << endl;
+        return;
+    }
+
+    //ET模式：整个loop为ET时，所有fd都带上EPOLLET
+    if(_edge_trigger)
+        mask |= EPOLLET;
+
+    //0.fd超出数组范围，扩容
+    if(fd >= (int)_handlers.size())
+        grow_handlers(fd);
+    event_handler& hdl = _handlers[fd];
+
+    //1.检测当前fd是否已有事件，得到op操作方式。
+    if(!(hdl.mask & (EPOLLIN | EPOLLOUT))){
         //如果不存在，add方式。
         op = EPOLL_CTL_ADD;
         final_mask = mask;
@@ -74,28 +200,27 @@ void event_loop::add_io_event(int fd, io_callback* io_cb, int mask, void* args){
     else{
         //如果存在，mod方式。
         op = EPOLL_CTL_MOD;
-        final_mask = it->second.mask | mask;
+        final_mask = hdl.mask | mask;
     }
 
-    //2.map中添加映射。fd和io_callback绑定。
+    //2.数组中添加映射。fd和io_callback绑定。
+    hdl.mask = final_mask;
     if(mask & EPOLLIN){
-        _fd2handler[fd].mask = final_mask;
-        _fd2handler[fd].read_callback = io_cb;
-        _fd2handler[fd].rcb_args = args;
+        hdl.read_callback = io_cb;
+        hdl.rcb_args = args;
     }
     else{
-        _fd2handler[fd].mask = final_mask;
-        _fd2handler[fd].write_callback = io_cb;
-        _fd2handler[fd].wcb_args = args;
+        hdl.write_callback = io_cb;
+        hdl.wcb_args = args;
     }
 
     //3.当前fd加入到正在监听的fd集合中
-    _listen_fds.insert(fd);
+    _listen_bits[fd / 64] |= (1ULL << (fd % 64));
 
     //4.原生事件上树。
     struct epoll_event ev;
     ev.events = final_mask;
-    ev.data.fd = fd;
+    fill_event_data(ev, fd);
     if(epoll_ctl(_epfd, op, fd, &ev) == -1){
         cerr << "Epoll ctl add/mod err." << endl;
         return;
@@ -104,17 +229,21 @@ void event_loop::add_io_event(int fd, io_callback* io_cb, int mask, void* args){
 
 //删除一个io事件从事件堆中
 void event_loop::del_io_event(int fd){
-    auto it = _fd2handler.find(fd);
-    if(it == _fd2handler.end()){
+    if(!is_listening(fd)){
         cout << "No such fd." << endl;
         return;
     }
 
-    //在映射中删除该事件。
-    _fd2handler.erase(fd);
+    //在映射中删除该事件，槽位清空留给之后复用该fd的链接。
+    //槽位本身不释放，本轮后续指向它的事件靠del_batch识别为过期
+    event_handler& hdl = _handlers[fd];
+    hdl.mask = 0;
+    hdl.read_callback = hdl.write_callback = nullptr;
+    hdl.rcb_args = hdl.wcb_args = nullptr;
+    hdl.del_batch = _batch_no;
 
     //从监听集合中删除该fd。
-    _listen_fds.erase(fd);
+    _listen_bits[fd / 64] &= ~(1ULL << (fd % 64));
 
     //原生事件下树。
     if( epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) == -1){
@@ -125,21 +254,30 @@ void event_loop::del_io_event(int fd){
 
 //删除一个io事件的某个事件位掩码。上个函数的重载版本。
 void event_loop::del_io_event(int fd, int mask){
-    auto it = _fd2handler.find(fd);
-    if(it == _fd2handler.end()){
+    if(!is_listening(fd)){
         cout << "No such fd." << endl;
         return;
     }
 
-    int final_mask = it->second.mask & (~mask);
-
-    if(final_mask == 0){        //如果事件掩码已经删完
+    if((_handlers[fd].mask & (~mask) & (EPOLLIN | EPOLLOUT)) == 0)
         cout << "No mask left. Delete cfd from epoll." << endl;
+    this->clear_io_mask(fd, mask);
+}
+
+//删除fd的某个事件位掩码，不打印日志。fd不在监听中直接返回
+void event_loop::clear_io_mask(int fd, int mask){
+    if(!is_listening(fd))
+        return;
+
+    int final_mask = _handlers[fd].mask & (~mask);
+    _handlers[fd].mask = final_mask;
+
+    if((final_mask & (EPOLLIN | EPOLLOUT)) == 0){        //如果读写掩码已经删完(只剩EPOLLET也算删完)
         this->del_io_event(fd);
     }else{       //此时就是修改
         struct epoll_event ev;
         ev.events = final_mask;
-        ev.data.fd = fd;
+        fill_event_data(ev, fd);
 
         if(epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == -1){
             cerr << "Epoll ctl mod error." << endl;
@@ -148,22 +286,280 @@ void event_loop::del_io_event(int fd, int mask){
     }
 }
 
-//添加一个任务到集合中
+//某个fd当前是否为边缘触发
+bool event_loop::is_edge_trigger(int fd){
+    if(!is_listening(fd))
+        return _edge_trigger;
+    return _handlers[fd].mask & EPOLLET;
+}
+
+//fd超出数组范围时扩容。翻倍扩容，fd是小而稠密的整数，扩容次数很少
+void event_loop::grow_handlers(int fd){
+    size_t old_size = _handlers.size();
+    size_t new_size = max<size_t>(old_size * 2, fd + 1);
+    //指针模式下不超出预留容量，vector在容量内resize不会搬家，epoll中保存的指针保持有效
+    if(_ptr_dispatch && (size_t)fd < _handlers.capacity())
+        new_size = min(new_size, _handlers.capacity());
+
+    event_handler* old_base = _handlers.data();
+    _handlers.resize(new_size);
+    for(size_t i = old_size; i < new_size; ++i)
+        _handlers[i].fd = i;
+    _listen_bits.resize((new_size + 63) / 64, 0);
+
+    //超出了预留容量(进程运行中调大了RLIMIT_NOFILE)，数组已搬家，所有指针重新上树
+    if(_ptr_dispatch && old_size > 0 && _handlers.data() != old_base){
+        cerr << "Handler table moved beyond reserved capacity, rebind " << fd << endl;
+        rebind_handlers();
+    }
+}
+
+//按当前模式把所有已注册fd重新上树
+void event_loop::rebind_handlers(){
+    listen_fds fds;
+    get_listen_fds(fds);
+    for(int fd : fds){
+        struct epoll_event ev;
+        ev.events = _handlers[fd].mask;
+        fill_event_data(ev, fd);
+        if(epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == -1)
+            cerr << "Epoll ctl rebind error." << endl;
+    }
+}
+
+//指针分发模式
+void event_loop::set_ptr_dispatch(bool on){
+    if(on == _ptr_dispatch)
+        return;
+
+    if(on){
+        //按进程最大fd数预留容量(只占虚拟内存，resize用到时才真正分配物理页)
+        struct rlimit rl;
+        size_t cap = 65536;
+        if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            cap = rl.rlim_cur;
+        cap = min<size_t>(cap, 1 << 20);
+        _handlers.reserve(cap);
+    }
+
+    _ptr_dispatch = on;
+    //已注册的fd按新模式重新上树
+    rebind_handlers();
+}
+
+//获取当前loop中监听fd集合。逐个64位字扫描位图，只在需要遍历时才用
+void event_loop::get_listen_fds(listen_fds& fds){
+    fds.clear();
+    for(size_t i = 0; i < _listen_bits.size(); ++i){
+        uint64_t bits = _listen_bits[i];
+        while(bits){
+            int bit = __builtin_ctzll(bits);    //最低位1的位置
+            fds.insert(i * 64 + bit);
+            bits &= bits - 1;                   //清掉最低位1
+        }
+    }
+}
+
+//设置每次epoll_wait最多取回的事件数
+void event_loop::set_epoll_batch(int batch){
+    if(batch <= 0)  batch = EPOLL_BATCH_INIT;
+    if(batch > EPOLL_BATCH_MAX) batch = EPOLL_BATCH_MAX;
+
+    _fired_evs.resize(batch);
+    _stat_batch_size.store(batch, memory_order_relaxed);
+}
+
+//从配置文件读取loop相关配置
+void event_loop::load_config(){
+    set_edge_trigger(config_file::instance()->GetBool("reactor", "edgeTrigger", false));
+    set_epoll_batch(config_file::instance()->GetNumber("reactor", "epollBatch", EPOLL_BATCH_INIT));
+    set_ptr_dispatch(config_file::instance()->GetBool("reactor", "ptrDispatch", false));
+    set_write_cork(config_file::instance()->GetBool("reactor", "writeCork", false));
+}
+
+//获取运行统计
+void event_loop::get_stats(loop_stats& stats){
+    stats.waits = _stat_waits.load(memory_order_relaxed);
+    stats.events = _stat_events.load(memory_order_relaxed);
+    stats.full_waits = _stat_full_waits.load(memory_order_relaxed);
+    stats.iters_per_sec = _stat_iters_per_sec.load(memory_order_relaxed);
+    stats.batch_size = _stat_batch_size.load(memory_order_relaxed);
+    stats.conns = _conn_cnt.load(memory_order_relaxed);
+    stats.flushes = _stat_flushes.load(memory_order_relaxed);
+    stats.flush_blocked = _stat_flush_blocked.load(memory_order_relaxed);
+}
+
+//在when_ms时刻执行一次
+int event_loop::run_at(uint64_t when_ms, timer_callback cb, void* args){
+    return _timers.add_timer(when_ms, 0, cb, args);
+}
+
+//delay_ms毫秒后执行一次
+int event_loop::run_after(uint64_t delay_ms, timer_callback cb, void* args){
+    return _timers.add_timer(now_ms() + delay_ms, 0, cb, args);
+}
+
+//每隔interval_ms毫秒执行一次
+int event_loop::run_every(uint64_t interval_ms, timer_callback cb, void* args){
+    if(interval_ms == 0){
+        cerr << "Timer interval must be positive." << endl;
+        return -1;
+    }
+    return _timers.add_timer(now_ms() + interval_ms, interval_ms, cb, args);
+}
+
+//取消一个定时器
+void event_loop::cancel_timer(int timer_id){
+    _timers.del_timer(timer_id);
+}
+
+//添加一个任务到队列尾部
 void event_loop::add_task(task_callback task_cb, void* args){
-    if(_ready_tasks.find(task_cb) != _ready_tasks.end())
-        cout << "Task callback existed. Covered." << endl;
-    
-    _ready_tasks[task_cb] = args;
+    _ready_tasks.push_back(async_task{task_cb, args, nullptr});
 }
 
-//执行全部异步任务
+void event_loop::add_task(task_func task){
+    _ready_tasks.push_back(async_task{nullptr, nullptr, std::move(task)});
+}
+
+//按投递顺序执行全部异步任务
 void event_loop::execute_ready_tasks(){
-    for(auto it : _ready_tasks){
-        it.first(this, it.second);
+    if(_ready_tasks.empty())
+        return;
+
+    //先换出来再执行：任务中可能继续add_task，放到下一轮，避免一直执行不到epoll_wait
+    _running_tasks.swap(_ready_tasks);
+    for(auto& task : _running_tasks){
+        if(task.cb)
+            task.cb(this, task.args);
+        else
+            task.func(this);
+    }
+
+    //全执行完，清空任务队列，保留容量
+    _running_tasks.clear();
+}
+
+//任意线程投递任务，已在本loop线程则立即执行，否则(包括loop还没启动)进收件箱
+void event_loop::run_in_loop(task_func task){
+    if(is_in_loop_thread())
+        task(this);
+    else
+        queue_in_loop(std::move(task));
+}
+
+//任意线程投递任务，总是排队执行
+void event_loop::queue_in_loop(task_func task){
+    //本线程内直接进异步任务队列，不需要系统调用。有任务时epoll_wait不阻塞
+    if(is_in_loop_thread())
+        add_task(std::move(task));
+    else
+        _inbox->send(task);
+}
+
+//收件箱可读，按投递顺序执行全部跨线程任务
+void event_loop::do_inbox(event_loop* loop, int fd, void* args){
+    queue<task_func> tasks;
+    loop->_inbox->recv(tasks);
+
+    while(!tasks.empty()){
+        tasks.front()(loop);
+        tasks.pop();
     }
+}
 
-    //全执行完，清空任务集合
-    _ready_tasks.clear();
+//=====================链接表======================
+//登记链接，返回句柄
+conn_id event_loop::add_conn(int fd, net_connection* conn){
+    if(fd >= (int)_conn_table.size())
+        _conn_table.resize(max<size_t>(_conn_table.size() * 2, fd + 1), conn_slot{nullptr, 0});
+
+    conn_slot& slot = _conn_table[fd];
+    slot.conn = conn;
+    //代数跳过0，保证句柄不为0
+    if(++slot.gen == 0)
+        slot.gen = 1;
+    return (conn_id)slot.gen << 32 | (uint32_t)fd;
+}
+
+//摘除链接，代数保留，下次复用该fd时继续加一
+void event_loop::del_conn(int fd){
+    if(fd >= 0 && fd < (int)_conn_table.size())
+        _conn_table[fd].conn = nullptr;
 }
 
+//按句柄查找链接
+net_connection* event_loop::get_conn(conn_id id){
+    int fd = (int)(uint32_t)id;
+    uint32_t gen = id >> 32;
+    if(fd < 0 || fd >= (int)_conn_table.size())
+        return nullptr;
 
+    conn_slot& slot = _conn_table[fd];
+    return slot.gen == gen ? slot.conn : nullptr;
+}
+
+//当前全部链接的句柄
+void event_loop::get_conn_ids(vector<conn_id>& ids){
+    ids.clear();
+    for(size_t fd = 0; fd < _conn_table.size(); ++fd){
+        if(_conn_table[fd].conn)
+            ids.push_back((conn_id)_conn_table[fd].gen << 32 | fd);
+    }
+}
+
+//跨线程向链接发消息
+void event_loop::send_to_conn(conn_id id, const char* data, int msglen, int msgid){
+    string msg(data, msglen);
+    run_in_loop([id, msg, msgid](event_loop* loop){
+        net_connection* conn = loop->get_conn(id);
+        if(conn)
+            conn->conn_write2fd(msg.data(), msg.size(), msgid);
+    });
+}
+
+//=====================空闲检查======================
+//把链接句柄放进when_ms所在的格子
+void event_loop::add_idle_check(conn_id id, uint64_t when_ms){
+    if(_idle_timer == -1){
+        _idle_wheel.resize(IDLE_WHEEL_SLOTS);
+        _idle_sec = _iter_ms / IDLE_TICK_MS;
+        _idle_timer = run_every(IDLE_TICK_MS, idle_tick, this);
+    }
+
+    //已到期的放到下一格；超过一圈的先放到最后一格，到时再检查一次
+    uint64_t sec = when_ms / IDLE_TICK_MS;
+    if(sec <= _idle_sec)
+        sec = _idle_sec + 1;
+    else if(sec >= _idle_sec + IDLE_WHEEL_SLOTS)
+        sec = _idle_sec + IDLE_WHEEL_SLOTS - 1;
+    _idle_wheel[sec % IDLE_WHEEL_SLOTS].push_back(id);
+}
+
+//处理上次之后到现在所有到期的格子。loop被长时间阻塞时一次补上，最多转一圈
+void event_loop::idle_tick(event_loop* loop, void* args){
+    uint64_t now = loop->_iter_ms;
+    uint64_t now_sec = now / IDLE_TICK_MS;
+    vector<conn_id> expired;
+
+    int turns = 0;
+    while(loop->_idle_sec < now_sec && turns++ < IDLE_WHEEL_SLOTS){
+        ++loop->_idle_sec;
+        expired.swap(loop->_idle_wheel[loop->_idle_sec % IDLE_WHEEL_SLOTS]);
+
+        for(conn_id id : expired){
+            //已关闭的链接句柄失效，直接丢掉
+            net_connection* conn = loop->get_conn(id);
+            if(!conn)
+                continue;
+
+            uint64_t next = conn->check_idle(now);
+            if(next != 0)
+                loop->add_idle_check(id, next);
+        }
+        expired.clear();
+    }
+    //落后超过一圈，剩下的格子已经在上面全部处理过
+    if(loop->_idle_sec < now_sec)
+        loop->_idle_sec = now_sec;
+}
@@ -4,10 +4,18 @@
 #include <stdio.h>
 
 //构造函数，创建一个size大小的buf
-//char[]()是c++风格，直接初始化。c则是char[]跟memset 0
-io_buf::io_buf(int size): capacity(size), length(0), head(0), data(new char[size]()), next(nullptr){
+//不清零(new char[size]而不是char[size]())：数据总是先写后读，清零只会把整块内存提前摸一遍，白占物理内存
+io_buf::io_buf(int size): capacity(size), length(0), head(0), data(new char[size]), next(nullptr){
     assert(data);
 }
+//使用外部提供的内存
+io_buf::io_buf(int size, char* mem): capacity(size), length(0), head(0), data(mem), next(nullptr){
+    assert(data);
+}
+//释放内存
+io_buf::~io_buf(){
+    delete[] data;
+}
 //清空数据
 void io_buf::clear()
 {
@@ -1,30 +1,65 @@
 #include "message.h"
 #include <iostream>
 
-//构造函数，初始化两个map
-msg_router::msg_router(): _msgid2router(), _msgid2args(){
+//构造函数
+msg_router::msg_router(): _dense(), _sparse(){
     printf("Router init succ.\n");
 //    cout << "Router init succ." << endl;
 }
 
 //注册一个msgid和对应回调函数的映射
 int msg_router::register_msg_router(int msgid, msg_callback msg_cb, void* usr_data){
-    if(_msgid2router.find(msgid) != _msgid2router.end())
-        cout << "Callback for msgID: " << msgid << "has already existed. Updated now." << endl;
-    _msgid2router[msgid] = msg_cb;
-    _msgid2args[msgid] = usr_data;
+    //装的是普通函数就取出函数指针，调用时不经过std::function
+    msg_route route;
+    msg_func* fn = msg_cb.target<msg_func>();
+    route.fn = fn ? *fn : nullptr;
+    if(!route.fn)
+        route.cb = msg_cb;
+    route.usr_data = usr_data;
+
+    this->set_route(msgid, route);
     return 0;
 }
 
-//调用对应回调函数的函数
+//注册一个msgid和批量路由回调的映射
+int msg_router::register_batch_router(int msgid, batch_callback batch_cb, void* usr_data){
+    msg_route route{nullptr, nullptr, batch_cb, usr_data};
+    this->set_route(msgid, route);
+    return 0;
+}
+
+//保存msgid的路由，已有的被替换
+void msg_router::set_route(int msgid, const msg_route& route){
+    if(find_route(msgid))
+        cout << "Callback for msgID: " << msgid << "has already existed. Updated now." << endl;
+
+    if(msgid >= 0 && msgid < ROUTER_DENSE_MAX){
+        if(msgid >= (int)_dense.size())
+            _dense.resize(msgid + 1, msg_route{nullptr, nullptr, nullptr, nullptr});
+        _dense[msgid] = route;
+    }
+    else{
+        _sparse[msgid] = route;
+    }
+}
+
+//调用对应回调函数的函数。一次查找
 void msg_router::call(int msgid, uint32_t msglen, const char* data, net_connection* conn){
-    if(_msgid2router.find(msgid) == _msgid2router.end()){
+    const msg_route* route = find_route(msgid);
+    if(!route){
         cout << "Callback for msgID " << msgid << "is not registered." << endl;
         return;
     }
 
-    auto callback = _msgid2router[msgid];  //注意，auto接map第二个值如果value不存在，会插入默认值。
-    auto usr_data = _msgid2args[msgid];     //所以前面的find是必要的
-    callback(data, msglen, msgid, conn, usr_data);
+    if(route->fn){
+        route->fn(data, msglen, msgid, conn, route->usr_data);
+    }
+    else if(route->cb){
+        route->cb(data, msglen, msgid, conn, route->usr_data);
+    }
+    else{
+        msg_frame frame{data, msglen};
+        route->batch(&frame, 1, msgid, conn, route->usr_data);
+    }
     //cout << "========================================================" << endl;
 }
@@ -1,7 +1,7 @@
 #include "reactor_buf.h"
 #include <string.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
+#include <errno.h>
 #include <iostream>
 using namespace std;
 
@@ -41,147 +41,411 @@ void reactor_buf::clear(){
 }
 
 //===========================================================================================
-//从一个fd中读取数据到io_buf中（fd到io层。在业务层处理数据）
-int input_buf::read_data(int fd){
-    int need_read = 0;     //硬件中有多少数据是可读
+atomic<uint64_t> input_buf::_stat_read_bytes(0);
+atomic<uint64_t> input_buf::_stat_copied_bytes(0);
 
-    /* 一次将io中所有缓存读出来。传出参数：目前socket缓冲中一共有多少数据可读。
-     * 注意：如果返回-1，通常是大问题，并且need_read不会修改。如果半关闭，只关闭写，那应该在read处返回0.
-     * */
-    if(ioctl(fd, FIONREAD, &need_read) == -1){        
-        cerr << "Ioctl FIOREAD error." << endl;
-        return -1;
+input_buf::~input_buf(){
+    this->clear();
+}
+
+//链上全部未消费数据的长度
+int input_buf::length(){
+    return _length;
+}
+
+//弹出已消费的len字节。整块消费完的io_buf直接归还
+void input_buf::pop(int len){
+    if(len > _length){
+        cerr << "Io_buf pop error!" << endl;
+        return;
     }
 
-    //内存缓冲区准备
-    if(!_buf){    //如果当前input_buf的_buf为空，从buf_pool取一个新的
-        _buf = buf_pool::get_instance()->alloc_buf(need_read);
-        if(!_buf){
-            cerr <<  "No new buf to alloc!" << endl;
-            return -1;
+    _length -= len;
+    while(len > 0){
+        if(len < _buf->length){
+            _buf->pop(len);
+            break;
+        }
+        len -= _buf->length;
+        io_buf* next = _buf->next;
+        buf_pool::get_instance()->revert(_buf);
+        _buf = next;
+    }
+
+    if(!_buf)   _tail = nullptr;
+}
+
+//清空整条链，归还内存池
+void input_buf::clear(){
+    while(_buf){
+        io_buf* next = _buf->next;
+        buf_pool::get_instance()->revert(_buf);
+        _buf = next;
+    }
+    _tail = nullptr;
+    _length = 0;
+}
+
+//获取当前数据，保证前len字节连续
+const char* input_buf::peek(int len){
+    if(!_buf)
+        return NULL;
+    if(len <= _buf->length)
+        return _buf->data + _buf->head;
+
+    //前len字节跨块：拷贝到一块新的io_buf中作为新的链表头，被拷贝完的旧块归还
+    io_buf* joined = buf_pool::get_instance()->alloc_buf(len);
+    if(!joined){
+        cerr <<  "No new buf to alloc!" << endl;
+        return NULL;
+    }
+
+    int left = len;
+    while(left > 0){
+        int n = _buf->length < left ? _buf->length : left;
+        memcpy(joined->data + joined->length, _buf->data + _buf->head, n);
+        joined->length += n;
+        left -= n;
+
+        if(n == _buf->length){
+            io_buf* next = _buf->next;
+            buf_pool::get_instance()->revert(_buf);
+            _buf = next;
+        }
+        else{
+            _buf->pop(n);
+        }
+    }
+
+    //链表头换成拼好的块。原来的块都拷贝完了的话它也是链表尾
+    joined->next = _buf;
+    if(!_buf)   _tail = joined;
+    _buf = joined;
+
+    _stat_copied_bytes.fetch_add(len, memory_order_relaxed);
+    return _buf->data;
+}
+
+//提前准备能放下整个消息的io_buf
+void input_buf::reserve(int len){
+    //链上数据已经够了，什么都不用做
+    if(!_buf || _length >= len)
+        return;
+
+    //之后读到的数据追加在链表尾。只有一块、且从消息开头算起剩余空间放得下时，消息才会是连续的
+    if(_buf == _tail){
+        if(_buf->capacity - _buf->head >= len)
+            return;
+        //容量够，只是前面有已消费的空洞，把数据挪到块首
+        if(_buf->capacity >= len){
+            _stat_copied_bytes.fetch_add(_buf->length, memory_order_relaxed);
+            _buf->adjust();
+            return;
         }
     }
-    else{              //如果当前有buf可用，判断是否够存
-        //有效数据头指针必须在内存块头部，防止有内存空洞（已消费未回收）
-        //后read是写到_buf->data + _buf->length位置, head有效数据必须在头部。
-        if(_buf->head != 0){
-            cerr << "Read failed. Used data not poped." << endl;
+
+    io_buf* joined = buf_pool::get_instance()->alloc_buf(len);
+    if(!joined)
+        return;     //拿不到大块就退回到收全后再peek拼接
+
+    //_length < len，整条链拷贝过去
+    for(io_buf* cur = _buf; cur; cur = cur->next){
+        memcpy(joined->data + joined->length, cur->data + cur->head, cur->length);
+        joined->length += cur->length;
+    }
+    _stat_copied_bytes.fetch_add(_length, memory_order_relaxed);
+
+    this->clear();
+    _buf = _tail = joined;
+    _length = joined->length;
+}
+
+//全局统计
+void input_buf::get_copy_stats(uint64_t& read_bytes, uint64_t& copied_bytes){
+    read_bytes = _stat_read_bytes.load(memory_order_relaxed);
+    copied_bytes = _stat_copied_bytes.load(memory_order_relaxed);
+}
+
+//从一个fd中读取数据到io_buf中（fd到io层。在业务层处理数据）
+int input_buf::read_data(int fd, bool drain){
+    int total = 0;
+    _peer_closed = false;
+
+    //LT模式读一次即可，没读完下次epoll_wait还会通知。
+    //ET模式只通知一次，必须读到EAGAIN，否则剩余数据要等到下一个包到来才会再被通知。
+    while(1){
+        int ret = read_once(fd);
+        if(ret > 0){
+            total += ret;
+            if(!drain)  break;
+        }
+        else if(ret == 0){
+            //对端关闭。已读到的数据仍然交给上层处理，处理完再关闭。
+            _peer_closed = true;
+            break;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK){
+            //已读空，不是错误
+            break;
+        }
+        else{
             return -1;
         }
+    }
 
-        if(_buf->capacity - _buf->length < need_read){  //不够存，取一块新的把新旧一起放进去
-            io_buf* new_buf = buf_pool::get_instance()->alloc_buf(need_read + _buf->length);
-            if(!new_buf){
-                cerr <<  "No new buf to alloc!" << endl;
-                return -1;
-            }
-            new_buf->copy(_buf);
-            buf_pool::get_instance()->revert(_buf);
-            _buf = new_buf;
+    if(total > 0)
+        _stat_read_bytes.fetch_add(total, memory_order_relaxed);
+    return total;
+}
+
+//栈上溢出区大小。尾部剩余空间放不下的数据先读到这里，再挂到链表尾部
+#define INPUT_EXTRA_BUF 65536
+
+//单次readv，返回值同read
+int input_buf::read_once(int fd){
+    /* 不再先ioctl(FIONREAD)问有多少数据：每次可读事件少一次系统调用，
+     * 也不会因为两次调用之间又来了数据而误判为读错误。
+     * 直接读进尾部io_buf的剩余空间，放不下的读进栈上的溢出区。
+     * */
+    char extra[INPUT_EXTRA_BUF];
+
+    //尾部没有剩余空间就先取一块新的，数据多数时候都能直接落进io_buf
+    io_buf* new_buf = nullptr;
+    io_buf* tail = _tail;
+    if(!tail || tail->capacity - tail->head - tail->length == 0){
+        new_buf = buf_pool::get_instance()->alloc_buf(m4K);
+        if(!new_buf){
+            cerr <<  "No new buf to alloc!" << endl;
+            errno = ENOMEM;
+            return -1;
         }
+        tail = new_buf;
     }
 
+    int tail_room = tail->capacity - tail->head - tail->length;
+    struct iovec iov[2];
+    iov[0].iov_base = tail->data + tail->head + tail->length;
+    iov[0].iov_len = tail_room;
+    iov[1].iov_base = extra;
+    iov[1].iov_len = sizeof(extra);
+
     //读取数据（替代read，fd到io层）
     //注意，此处不是循环读取, while只是处理EINTR情况
     int already_read = 0;
     do{
-        if(need_read == 0){
-            already_read = read(fd, _buf->data + _buf->length, m4K);    //选一个最小的读，非阻塞模式是不会阻塞的。
-        }else{
-            already_read = read(fd, _buf->data + _buf->length, need_read);  
-        }
+        already_read = readv(fd, iov, 2);
     }while(already_read == -1 && errno == EINTR);   //良性，继续读取
 
+    //EAGAIN在read_data中处理：LT下是偶发的空唤醒，ET下是读空的正常出口
 
-    /*
-     * 虽然非阻塞判断EAGAIN是POSIX标准的标准规定，不应该是可选行为
-     * 但，这里不需要，因为io_buf会确保有足够空间(message.h限制了报文大小)，且Reactor本身就是确保了有数据才会来读。
-     * */
+    if(already_read <= 0){
+        //新块没用上，归还
+        if(new_buf)     buf_pool::get_instance()->revert(new_buf);
+        return already_read;
+    }
 
-    if(already_read > 0){
-        //防止异常。前面need_read获取大小，到读之前可能因为网络中断、信号打断，只能读到一部分。
-        if(already_read != need_read){
-            cerr << "Unexpected read error!" << endl;
+    //1. 尾部读到的部分。新取的块挂到链表尾部
+    int n = already_read < tail_room ? already_read : tail_room;
+    tail->length += n;
+    if(new_buf){
+        if(_tail)   _tail->next = new_buf;
+        else        _buf = new_buf;
+        _tail = new_buf;
+    }
+
+    //2. 溢出区的部分拷贝到一块新的io_buf，挂到链表尾部
+    int extra_len = already_read - n;
+    if(extra_len > 0){
+        io_buf* extra_buf = buf_pool::get_instance()->alloc_buf(extra_len);
+        if(!extra_buf){
+            //数据已经从内核读出来了，放不下只能断开
+            cerr <<  "No new buf to alloc!" << endl;
+            _length += n;
+            errno = ENOMEM;
             return -1;
         }
-        //读取数据成功
-        //io缓冲区是累计的，上面read就是从length开始读的，用+=
-        _buf->length += already_read;
+        memcpy(extra_buf->data, extra, extra_len);
+        extra_buf->length = extra_len;
+        _tail->next = extra_buf;
+        _tail = extra_buf;
+        _stat_copied_bytes.fetch_add(extra_len, memory_order_relaxed);
     }
+    _length += already_read;
 
-    //和output_buf不一样的是，这里还在io层，尚未处理，在tcp_conn, tcp_client中拿到ibuf.data()再弹出+回收。
+    //和output_buf不一样的是，这里还在io层，尚未处理，在tcp_conn, tcp_client中拿到ibuf.peek()再弹出。
 
     return already_read;
 }
 
-//获取当前数据
-const char* input_buf::data(){
-    return _buf ? _buf->data + _buf->head : NULL;
+//===========================================================================================
+//writev一次最多带多少个io_buf
+#define OUTPUT_IOV_MAX 64
+
+output_buf::~output_buf(){
+    this->clear();
 }
 
-//回收已消费数据
-void input_buf::adjust(){
-    if(_buf)
-        _buf->adjust();
+//链上全部未发送数据的长度
+int output_buf::length(){
+    return _length;
+}
+
+//弹出已发送的len字节。整块发完的io_buf直接归还，不需要adjust搬移数据
+void output_buf::pop(int len){
+    if(len > _length){
+        cerr << "Io_buf pop error!" << endl;
+        return;
+    }
+
+    _length -= len;
+    while(len > 0){
+        if(len < _buf->length){
+            _buf->pop(len);
+            break;
+        }
+        len -= _buf->length;
+        io_buf* next = _buf->next;
+        buf_pool::get_instance()->revert(_buf);
+        _buf = next;
+    }
+
+    if(!_buf)   _tail = nullptr;
+}
+
+//清空整条链，归还内存池
+void output_buf::clear(){
+    while(_buf){
+        io_buf* next = _buf->next;
+        buf_pool::get_instance()->revert(_buf);
+        _buf = next;
+    }
+    _tail = nullptr;
+    _length = 0;
 }
 
-//===========================================================================================
 //将一段数据写到io_buf中（业务层到io层交界处）。
 int output_buf::write2buf(const char* data, int datalen){
-    //内存缓冲区准备
-    if(!_buf){         //当前output_buf的_buf为空，从buf_pool取一个新的
-        _buf = buf_pool::get_instance()->alloc_buf(datalen);
-        if(!_buf){
+    struct iovec iov = {(void*)data, (size_t)datalen};
+    return this->append(&iov, 1, 0);
+}
+
+//将一组数据整体写到io_buf中
+int output_buf::write2buf(const struct iovec* iov, int iovcnt){
+    return this->append(iov, iovcnt, 0);
+}
+
+//跳过iov的前skip字节，剩余的整体追加到链表尾。
+//先申请好尾块放不下的部分再拷贝，申请失败时缓冲不变，不会留下半个消息
+int output_buf::append(const struct iovec* iov, int iovcnt, int skip){
+    int total = -skip;
+    for(int i = 0; i < iovcnt; ++i)
+        total += iov[i].iov_len;
+    if(total <= 0)
+        return 0;
+
+    //1. 尾部io_buf剩余的空间。已发送的部分(head之前)不回收，发完整块就归还
+    int room = _tail ? _tail->capacity - _tail->head - _tail->length : 0;
+
+    //2. 放不下的部分需要一块新的io_buf
+    io_buf* new_buf = nullptr;
+    if(total > room){
+        new_buf = buf_pool::get_instance()->alloc_buf(total - room);
+        if(!new_buf){
             cerr <<  "No new buf to alloc!" << endl;
-        return -1;
+            return -1;
         }
     }
-    else{       //如果当前有buf可用，判断是否够存
-        if(_buf->head != 0){
-            cerr << "Read failed. Used data not poped." << endl;
-            return -1;
+
+    //3. 拷贝：先填满尾块，剩下的进新块，新块挂到链表尾部
+    for(int i = 0; i < iovcnt; ++i){
+        const char* data = (const char*)iov[i].iov_base;
+        int len = iov[i].iov_len;
+        if(skip >= len){
+            skip -= len;
+            continue;
         }
-        if(_buf->capacity - _buf->length < datalen){  //不够存，取一块新的把新旧一起放进去
-            io_buf* new_buf = buf_pool::get_instance()->alloc_buf(datalen + _buf->length);
-            if(!new_buf){
-                cerr <<  "No new buf to alloc!" << endl;
-                return -1;
-            }
-            new_buf->copy(_buf);
-            buf_pool::get_instance()->revert(_buf);
-            _buf = new_buf;
+        data += skip;
+        len -= skip;
+        skip = 0;
+
+        if(room > 0){
+            int n = room < len ? room : len;
+            memcpy(_tail->data + _tail->head + _tail->length, data, n);
+            _tail->length += n;
+            room -= n;
+            data += n;
+            len -= n;
+        }
+        if(len > 0){
+            memcpy(new_buf->data + new_buf->length, data, len);
+            new_buf->length += len;
         }
     }
-    
-    //将data数据写到io_buf中，拼接到后面
-    memcpy(_buf->data + _buf->length, data ,datalen);
-    _buf->length += datalen;
+    _length += total;
+
+    if(new_buf){
+        if(_tail)   _tail->next = new_buf;
+        else        _buf = new_buf;
+        _tail = new_buf;
+    }
 
     return 0;
 }
 
-//将io_buf中数据写到fd中。取代write（io层到内核）。
-int output_buf::write2fd(int fd){
-    int already_write = 0;
+//发送一组数据，缓冲为空时直接writev，只缓冲没写完的部分
+int output_buf::send_iov(int fd, const struct iovec* iov, int iovcnt){
+    int written = 0;
 
-    do{
-        already_write = write(fd, _buf->data, _buf->length);    
-    }while(already_write == -1 && errno == EINTR);
+    //缓冲中还有旧数据时不能直接写，否则乱序
+    if(_length == 0){
+        do{
+            written = writev(fd, iov, iovcnt);
+        }while(written == -1 && errno == EINTR);
 
-    if(already_write > 0){
-        //写成功，弹出已消费数据，再回收已消费数据。
-        //因为这个函数也是每次从_buf->data开始读到fd(和上一个函数无关，上一个函数可以在io层拼接，一起写入fd)
-        _buf->pop(already_write);
-        _buf->adjust();
+        if(written < 0)
+            written = 0;    //EAGAIN或出错，全部进缓冲。出错时之后的write2fd会再次遇到并上报
     }
 
-    //如果fd是非阻塞的，可能写内存满无法写入
-    if(already_write == -1 && errno == EAGAIN){
-        already_write = 0;      //不是一个错误，表示为写0字节。
-    }
-    
-    return already_write;
+    //跳过已写出的部分，剩余的拷贝到缓冲
+    if(this->append(iov, iovcnt, written) != 0)
+        return written > 0 ? -2 : -1;
+
+    return 0;
 }
 
+//将io_buf中数据写到fd中。取代write（io层到内核）。
+int output_buf::write2fd(int fd){
+    int total = 0;
+
+    //一直写到缓冲写空或内核发送缓冲满(EAGAIN)。ET模式下写事件只通知一次，必须写到EAGAIN。
+    while(_length > 0){
+        //整条链(最多OUTPUT_IOV_MAX块)一次writev
+        struct iovec iov[OUTPUT_IOV_MAX];
+        int iovcnt = 0;
+        for(io_buf* cur = _buf; cur && iovcnt < OUTPUT_IOV_MAX; cur = cur->next){
+            iov[iovcnt].iov_base = cur->data + cur->head;
+            iov[iovcnt].iov_len = cur->length;
+            ++iovcnt;
+        }
 
+        int already_write = 0;
+        do{
+            already_write = writev(fd, iov, iovcnt);
+        }while(already_write == -1 && errno == EINTR);
 
+        if(already_write > 0){
+            //写成功，弹出已发送数据，发完的io_buf归还内存池
+            this->pop(already_write);
+            total += already_write;
+        }
+        else if(already_write == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            //fd是非阻塞的，内核发送缓冲满无法写入。不是一个错误
+            break;
+        }
+        else{
+            return -1;
+        }
+    }
+    
+    return total;
+}
@@ -1,5 +1,5 @@
 #include "tcp_client.h"
-#include "message.h"
+#include "frame_decoder.h"
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
@@ -19,7 +19,9 @@ void cli_wt_callback(event_loop* loop, int fd, void* args){
 
 //构造函数
 tcp_client::tcp_client(event_loop* loop, const char* ip, uint16_t port):
-    _cfd(-1), _loop(loop), _ibuf(), _obuf(), _router() {
+    _conn_start_cb(NULL), _conn_start_cb_args(nullptr), _conn_close_cb(NULL), _conn_close_cb_args(nullptr),
+    _high_water_cb(NULL), _high_water_cb_args(nullptr), _write_complete_cb(NULL), _write_complete_cb_args(nullptr),
+    _cfd(-1), _loop(loop), _ibuf(), _obuf(), _router(), _high_water(OUTPUT_HIGH_WATER), _low_water(0), _over_high(false), _heartbeat_msgid(0) {
         //封装客户端ip地址信息
         _saddr.sin_family = AF_INET;
         _saddr.sin_port = htons(port);
@@ -40,95 +42,110 @@ int tcp_client::conn_write2fd(const char* data, int msglen, int msgid){
     head.msgid = htonl(msgid);
     head.msglen = htonl(msglen);
 
-    //1. 将消息头写到obuf中
-    int ret = _obuf.write2buf((const char*)&head, MESSAGE_HEAD_LEN);
-    if(ret != 0){
-        cerr << "Client write2buf head  error." << endl;
+    //消息头和消息体一起发送。_obuf为空时直接writev，没写完(或还在建链中)的部分进_obuf
+    struct iovec iov[2] = {{&head, MESSAGE_HEAD_LEN}, {(void*)data, (size_t)msglen}};
+    int ret = _obuf.send_iov(_cfd, iov, 2);
+    if(ret == -2){
+        //消息已发出一部分，对端的解析已经错位，只能断开
+        cerr << "Client send data error. Frame torn, disconnect." << endl;
+        this->do_disconnect();
         return -1;
     }
-    //2. 将消息体写到obuf中
-    ret = _obuf.write2buf(data, msglen);
     if(ret != 0){
-        cerr << "Client write2buf data error." << endl;
-        //如果写消息体失败，消息头也要弹出
-        _obuf.pop(MESSAGE_HEAD_LEN);
+        cerr << "Client send data error." << endl;
         return -1;
     }
 
-    if(active_epollout)   
+    if(active_epollout && _obuf.length() > 0)   
         _loop->add_io_event(_cfd, cli_wt_callback, EPOLLOUT, this);
 
+    this->check_high_water();
     return 0;
 }
 
+//输出缓冲超过高水位，通知生产者。只在越过时通知一次
+void tcp_client::check_high_water(){
+    if(_over_high || _high_water == 0 || _obuf.length() < _high_water)
+        return;
+
+    _over_high = true;
+    if(_high_water_cb != NULL)
+        _high_water_cb(this, _high_water_cb_args);
+}
+
+//超过高水位后回落到低水位，通知生产者继续
+void tcp_client::check_low_water(){
+    if(!_over_high || _obuf.length() > _low_water)
+        return;
+
+    _over_high = false;
+    if(_write_complete_cb != NULL)
+        _write_complete_cb(this, _write_complete_cb_args);
+}
+
 //处理读业务
 void tcp_client::do_read(){
-    //1. 从_cfd中读数据
-    int ret = _ibuf.read_data(_cfd);
+    //1. 从_cfd中读数据。ET模式下要一直读到EAGAIN
+    int ret = _ibuf.read_data(_cfd, _loop->is_edge_trigger(_cfd));
     if(ret == -1){
         cerr << "Client read data error." << endl;
         this->do_disconnect();
         return;
     }
-    else if(ret == 0){
+    else if(ret == 0 && _ibuf.peer_closed()){
         cout << "Server closed." << endl;
         this->do_disconnect();
         return;
     }
-    //2. 判断读出来数据的合法性
-    msg_head head;
-    while(_ibuf.length() >= MESSAGE_HEAD_LEN){
-        //2.1 先读头部，得到msgid、msglen,并且立刻转换为小端
-        memcpy(&head, _ibuf.data(), MESSAGE_HEAD_LEN);
-        head.msgid = ntohl(head.msgid);
-        head.msglen = ntohl(head.msglen);
-        //msglen如果已经非法，退出并断开连接，防御性工程
-        if(head.msglen > MESSAGE_LENGTH_LIMIT || head.msglen < 0){
-            cerr << "Invalid data. Too large or negative. Close cfd." << endl;
-            this->do_disconnect();
-            break;
+    //2. 解析出全部完整的消息交给路由，msglen非法或申请不到内存时断开
+    msg_batch batch(_router, this);
+    int frames = decode_frames(_ibuf, [this, &batch](int msgid, int msglen, const char* data){
+        //服务器的心跳，回一个同id的空消息。先交出攒着的消息，回复顺序不变
+        if(msgid == _heartbeat_msgid && msgid != 0){
+            batch.flush();
+            if(_cfd != -1)
+                this->conn_write2fd("", 0, _heartbeat_msgid);
         }
+        else
+            batch.add(msgid, msglen, data);
+        //回调中断开了链接，_ibuf已清空
+        return _cfd != -1;
+    }, [this, &batch](){
+        batch.flush();
+        return _cfd != -1;
+    });
+    if(frames == -1){
+        cerr << "Invalid data. Too large or negative. Close cfd." << endl;
+        this->do_disconnect();
+        return;
+    }
+    if(_cfd == -1)
+        return;
 
-        //2.2 判断实际缓冲接受长度和头部记录是否一致
-        if(_ibuf.length() < MESSAGE_HEAD_LEN + head.msglen){
-            //缓冲实际长度比记录的小，说明不是一个完整的包，继续接收。此处不应断开连接。
-            break;
-        }
-
-        //弹出消息头长度
-        _ibuf.pop(MESSAGE_HEAD_LEN);
-
-        //3，执行注册的回显业务
-        this->_router.call(head.msgid, head.msglen, _ibuf.data(), this);
-
-        //弹出消息体长度
-        _ibuf.pop(head.msglen);
+    //数据和FIN一起到达，已收到的包处理完再断开
+    if(_ibuf.peer_closed()){
+        cout << "Server closed." << endl;
+        this->do_disconnect();
     }
-    _ibuf.adjust();
 
     return;
 }
 
 //处理写业务
 void tcp_client::do_write(){
-    while(_obuf.length()){
-        int ret = _obuf.write2fd(_cfd);
-        if(ret == -1){
-            cerr << "Client write2fd error." << endl;
-            this->do_disconnect();
-            return;
-        }
-        else if(ret == 0){
-            cout << "Obuf full, EAGAIN." <<  endl;
-            break;  //当前不可写，obuf满，即EAGAIN
-        }
-
-        //数据全部写完，_cfd事件的读掩码删掉
-        if(_obuf.length() == 0)      
-            _loop->del_io_event(_cfd, EPOLLOUT);
-
+    //write2fd内部一直写到写空或EAGAIN
+    int ret = _obuf.write2fd(_cfd);
+    if(ret == -1){
+        cerr << "Client write2fd error." << endl;
+        this->do_disconnect();
+        return;
     }
 
+    //数据全部写完，_cfd事件的写掩码删掉。没写完(EAGAIN)就等下次可写
+    if(_obuf.length() == 0)      
+        _loop->del_io_event(_cfd, EPOLLOUT);
+
+    this->check_low_water();
     return;
 }
 
@@ -220,6 +237,10 @@ void tcp_client::do_disconnect(){
     if(_cfd != -1){
         _loop->del_io_event(_cfd);
         close(_cfd);
+        _cfd = -1;
+        //未处理的数据属于旧链接，重连后不能再解析
+        _ibuf.clear();
+        _obuf.clear();
     }
     else    
         cout << "Client already disconnected." << endl;
@@ -1,14 +1,20 @@
 #include "tcp_server.h"
 #include "tcp_conn.h"
-#include "message.h"
+#include "frame_decoder.h"
 #include <iostream>
-#include <fcntl.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <cstring>
+#include <algorithm>
 using namespace std;
 
+//暂停读后每隔多久检查一次内存是否回落，毫秒
+#define READ_RESUME_MS 50
+
+//攒写模式下不超过这个长度的消息只拷贝进_obuf，本轮末尾统一写出；更大的消息直接writev，省掉拷贝
+#define CORK_MSG_MAX 16384
+
 //这两个函数仅为了满足io_callback签名，所以参数是this直接调用相应函数
 void conn_rd_callback(event_loop* loop, int fd, void* args){
     tcp_conn* conn = (tcp_conn*)args;
@@ -20,114 +26,124 @@ void conn_wt_callback(event_loop* loop, int fd, void* args){
     conn->do_write();
 }
 
+static void conn_resume_callback(event_loop* loop, void* args){
+    tcp_conn* conn = (tcp_conn*)args;
+    conn->resume_read();
+}
+
+static void conn_delete_task(event_loop* loop, void* args){
+    delete (tcp_conn*)args;
+}
+
 //构造函数
-tcp_conn::tcp_conn(int cfd, event_loop* loop):_cfd(cfd), _loop(loop){
-    //1. 将cfd设置为非阻塞状态
-    int flag = fcntl(_cfd, F_GETFL);
-    fcntl(_cfd, F_SETFL, flag|O_NONBLOCK);
+tcp_conn::tcp_conn(int cfd, event_loop* loop):_cfd(cfd), _loop(loop), _conn_id(0), _resume_timer(-1), _flush_pending(false), _over_high(false),
+    _last_active(loop->iter_ms()), _probed(false){
+    //1. cfd由accept4创建时已是非阻塞状态
 
     //2. 设置tcp_nodelay状态，禁止读写缓存，降低小包延迟
     //一般读写都要缓存满一定大小才发送，这里禁止，即使1字节。游戏如lol是必设置的。
     int op = 1;
     setsockopt(_cfd, IPPROTO_TCP, TCP_NODELAY, &op, sizeof(op));    //需要netinet两个头文件
 
-    //3. 执行链接成功的Hook函数
+    //3. 将自己登记到所属loop的链接表中，Hook函数中即可拿到句柄
+    _conn_id = _loop->add_conn(_cfd, this);
+
+    //4. 执行链接成功的Hook函数
     if (tcp_server::_conn_start_cb != NULL) 
         tcp_server::_conn_start_cb(this, tcp_server::_conn_start_cb_args);
 
-    //4. 将当前读事件加入事件堆检测
+    //5. 将当前读事件加入事件堆检测
     _loop->add_io_event(_cfd, conn_rd_callback, EPOLLIN, this); 
 
-    //将自己添加到 tcp_server中的conns集合中
-    tcp_server::increase_conn(_cfd, this);
+    //6. 开启了空闲回收的，放进所属loop的时间轮
+    if(tcp_server::_idle_ms > 0){
+        uint64_t wait = tcp_server::_heartbeat_msgid ? tcp_server::_idle_ms / 2 : tcp_server::_idle_ms;
+        _loop->add_idle_check(_conn_id, _last_active + wait);
+    }
 }
 
 //被动处理读业务的方法，由事件堆检测到触发
 void tcp_conn::do_read(){
-    //1. 从cfd中读数据
-    int ret = _ibuf.read_data(_cfd);
+    //0. 内存池超过软上限，先不读，让数据留在内核缓冲里，由TCP把对端挡住
+    if(buf_pool::get_instance()->over_soft_limit()){
+        this->pause_read();
+        return;
+    }
+
+    //1. 从cfd中读数据。ET模式下要一直读到EAGAIN
+    //内存池到了硬上限时申请失败返回-1，断开这个链接(甩掉负载)，不退出进程
+    int ret = _ibuf.read_data(_cfd, _loop->is_edge_trigger(_cfd));
     if(ret == -1){
         cerr << "Read data from cfd error." << endl;
         this->destroy_conn();
         return;
     }
-    else if(ret == 0){
+    else if(ret == 0 && _ibuf.peer_closed()){
         cout << "Cfd closed. Read failure." << endl;
         this->destroy_conn();
         return;
     }
+    //读到数据即为活跃，只记下本轮的时刻，不动时间轮
+    if(ret > 0){
+        _last_active = _loop->iter_ms();
+        _probed = false;
+    }
 
-    //2. 判断长度是否足够有效，要大于等于消息头（8字节）
-    //字节序问题应该一取出就转换小端。这个判断完就立刻转换
-    //注：使用protobuf后自动处理
-    msg_head head;
-    while(_ibuf.length() >= MESSAGE_HEAD_LEN){
-        //2.1 先读头部，得到msgid,msglen。如果记录的长度已经非法，关闭。
-        memcpy(&head, _ibuf.data(), MESSAGE_HEAD_LEN);
-        //2.2 立刻转换小端。大端的话，是无法正常使用的
-        head.msgid = ntohl(head.msgid);
-        head.msglen = ntohl(head.msglen);
-        if(head.msglen > MESSAGE_LENGTH_LIMIT || head.msglen < 0){
-            cerr << "Invalid data. Too large or negative. Close cfd." << endl;
-            this->destroy_conn();
-            break;
-        }
-
-        //2.3 判断实际_ibuf中数据长度和头部里记录的长度是否一致。
-        if(_ibuf.length() < MESSAGE_HEAD_LEN + head.msglen){
-            //缓存中buf剩余的数据，应该小于该接收的数据。
-            //说明这不是一个完整的包，继续接收。
-            break;
-        }
-
-        //弹出消息头长度
-        _ibuf.pop(MESSAGE_HEAD_LEN);
-
-        //3. 处理业务数据
-        //执行回显任务
-        tcp_server::_router.call(head.msgid, head.msglen, _ibuf.data(), this); //this是tcp_conn对象
+    //2. 解析出全部完整的消息交给路由，不完整的留在_ibuf中等下次。批量路由的消息由batch攒批，pop前交出。
+    //字节序在解析时转换，消息长度非法(过大或为负)或拼接跨块消息申请不到内存(硬上限)时关闭
+    msg_batch batch(tcp_server::_router, this);     //this是tcp_conn对象
+    int frames = decode_frames(_ibuf, [this, &batch](int msgid, int msglen, const char* data){
+        //心跳消息只用来保活，不进路由
+        if(msgid != tcp_server::_heartbeat_msgid || msgid == 0)
+            batch.add(msgid, msglen, data);
+        //回调中链接被关闭，_ibuf已清空
+        return _cfd != -1;
+    }, [this, &batch](){
+        batch.flush();
+        return _cfd != -1;
+    });
+    if(frames == -1){
+        cerr << "Invalid data. Too large or negative. Close cfd." << endl;
+        this->destroy_conn();
+        return;
+    }
+    if(_cfd == -1)
+        return;
 
-        //整个消息处理完了，弹出
-        _ibuf.pop(head.msglen);
+    //数据和FIN一起到达(ET下常见)，已收到的包处理完再关闭
+    if(_ibuf.peer_closed()){
+        cout << "Cfd closed. Read failure." << endl;
+        this->destroy_conn();
     }
-    //回收已消费数据
-    _ibuf.adjust();
     return;
 }
 
 //被动处理写业务的方法，由事件堆检测到触发
 void tcp_conn::do_write(){
     //do write就表示_obuf中已经有要写的数据，将_obuf中的数据发送给fd，给到对端
-    while(_obuf.length()){
-        int ret = _obuf.write2fd(_cfd);
-        if(ret == -1){
-            cerr << "Tcp_conn write cfd error." << endl;
-            this->destroy_conn();
-            return;
-        }
-        else if(ret == 0){
-            //当前不可写
-            break;
-        }
+    //write2fd内部一直写到写空或EAGAIN
+    int ret = _obuf.write2fd(_cfd);
+    if(ret == -1){
+        cerr << "Tcp_conn write cfd error." << endl;
+        this->destroy_conn();
+        return;
     }
+    //对端窗口打开、数据写出去了，也算活跃
+    if(ret > 0)
+        _last_active = _loop->iter_ms();
 
     if(_obuf.length() == 0){
         //数据已经全部写完，将cfd的写事件删掉
         _loop->del_io_event(_cfd, EPOLLOUT);
     }
-    
+
+    this->check_low_water();
     return;
 }
 
 //主动发送消息的方法。
 int tcp_conn::conn_write2fd(const char* data, int msglen, int msgid){
-    //用于判断是否需要添加cfd的写事件回调。回调是io层到fd。
-    //因为如果_obuf不为空，说明还有之前的数据没写到对端，那么就没必要再激活，写完再激活
-    bool active_epollout = false;
-    if(_obuf.length() == 0){
-        active_epollout = true;
-    }    
-    //1. 封装一个消息头,并写到_obuf中
+    //1. 封装一个消息头
     msg_head head{msgid, msglen};
     
     //1.1 在进入缓冲区前，要转换大端。protobuf不需要。
@@ -135,42 +151,190 @@ int tcp_conn::conn_write2fd(const char* data, int msglen, int msgid){
     head.msgid = htonl(msgid);
     head.msglen = htonl(msglen);
 
-    int ret = _obuf.write2buf((const char*)&head, MESSAGE_HEAD_LEN);
-    if(ret != 0){
-        cerr << "Server send head error." << endl;
+    //2. 攒写模式：小消息只拷贝进_obuf，登记到loop的flush列表，本轮末尾和同一轮的其他消息一起一次writev。
+    //_obuf不为空又没登记，说明已挂着EPOLLOUT，写事件回调会把它写出去
+    //消息头和消息体整体进缓冲，申请不到内存时缓冲不变，这个消息不发
+    struct iovec iov[2] = {{&head, MESSAGE_HEAD_LEN}, {(void*)data, (size_t)msglen}};
+    if(_loop->is_write_cork() && msglen <= CORK_MSG_MAX){
+        bool was_empty = _obuf.length() == 0;
+        if(_obuf.write2buf(iov, 2) != 0){
+            cerr << "Server send data error." << endl;
+            return -1;
+        }
+        if(was_empty && !_flush_pending){
+            _flush_pending = true;
+            _loop->add_flush(_conn_id);
+        }
+        this->check_high_water();
+        return 0;
+    }
+
+    //3. 大消息前面还有本轮攒下的数据，先写出去，大消息才能不经过缓冲拷贝。和flush_output一样，出错就关闭
+    if(_flush_pending && _obuf.write2fd(_cfd) == -1){
+        cerr << "Tcp_conn flush cfd error." << endl;
+        this->destroy_conn();
         return -1;
     }
 
-    //2. 写消息体
-    ret = _obuf.write2buf(data, msglen);
+    //用于判断是否需要添加cfd的写事件回调。回调是io层到fd。
+    //因为如果_obuf不为空，说明还有之前的数据没写到对端，那么就没必要再激活，写完再激活。
+    //已登记flush的由flush_output决定是否挂EPOLLOUT
+    bool active_epollout = false;
+    if(_obuf.length() == 0 && !_flush_pending){
+        active_epollout = true;
+    }    
+
+    //4. 消息头和消息体一起发送。_obuf为空时直接writev给cfd，不经过缓冲拷贝，没写完的才进_obuf
+    int ret = _obuf.send_iov(_cfd, iov, 2);
+    if(ret == -2){
+        //消息已发出一部分，对端的解析已经错位，只能关闭
+        cerr << "Server send data error. Frame torn, close cfd." << endl;
+        this->destroy_conn();
+        return -1;
+    }
     if(ret != 0){
         cerr << "Server send data error." << endl;
-        //如果消息体写失败，消息头也要弹出
-        _obuf.pop(MESSAGE_HEAD_LEN);
         return -1;
     }
 
-    //3. 将cfd添加写事件EPOLLOUT，回调会将_obuf中的数据写给对端。
-    if(active_epollout == true)  _loop->add_io_event(_cfd, conn_wt_callback, EPOLLOUT, this);
+    //5. 还有数据没写出去，将cfd添加写事件EPOLLOUT，回调会将_obuf中的数据写给对端。
+    if(active_epollout == true && _obuf.length() > 0)  _loop->add_io_event(_cfd, conn_wt_callback, EPOLLOUT, this);
 
+    //水位按发送后的缓冲长度计算：先写出的攒写数据可能让缓冲回落到低水位。
+    //低水位Hook放在大消息发出之后，Hook里再发的消息不会排到它前面
+    this->check_high_water();
+    this->check_low_water();
     return 0;
 }
 
+//空闲检查，由时间轮到期时调用
+uint64_t tcp_conn::check_idle(uint64_t now_ms){
+    //读被内存软上限暂停：没有数据进来是在等背压，不是对端空闲。按刚活跃过计算
+    if(_resume_timer != -1){
+        _last_active = now_ms;
+        _probed = false;
+    }
+
+    uint64_t idle = now_ms - _last_active;
+    bool heartbeat = tcp_server::_heartbeat_msgid != 0;
+
+    //时间轮按格(IDLE_TICK_MS)检查，检查时刻可能比预定的早一点、晚一格。
+    //开了心跳的链接必须先发过心跳、对端一直没回才关闭，不会因为错过心跳的时间窗口被误关
+    if(idle >= tcp_server::_idle_ms && (!heartbeat || _probed)){
+        cout << "Cfd idle for " << idle / 1000 << "s. Close." << endl;
+        this->destroy_conn();
+        return 0;
+    }
+
+    //空闲一半超时时间，发一次心跳，对端回了就会刷新活跃时间。至少留半个超时时间等回复
+    if(heartbeat && idle >= tcp_server::_idle_ms / 2){
+        if(!_probed){
+            _probed = true;
+            this->conn_write2fd("", 0, tcp_server::_heartbeat_msgid);
+            return max(_last_active + tcp_server::_idle_ms, now_ms + tcp_server::_idle_ms / 2);
+        }
+        return _last_active + tcp_server::_idle_ms;
+    }
+
+    uint64_t wait = heartbeat ? tcp_server::_idle_ms / 2 : tcp_server::_idle_ms;
+    return _last_active + wait;
+}
+
+//输出缓冲超过高水位，通知生产者。只在越过时通知一次，回落到低水位后才会再次通知
+void tcp_conn::check_high_water(){
+    if(_over_high || tcp_server::_high_water == 0 || _obuf.length() < tcp_server::_high_water)
+        return;
+
+    _over_high = true;
+    if(tcp_server::_high_water_cb != NULL)
+        tcp_server::_high_water_cb(this, tcp_server::_high_water_cb_args);
+}
+
+//超过高水位后回落到低水位，通知生产者继续
+void tcp_conn::check_low_water(){
+    if(!_over_high || _obuf.length() > tcp_server::_low_water)
+        return;
+
+    _over_high = false;
+    if(tcp_server::_write_complete_cb != NULL)
+        tcp_server::_write_complete_cb(this, tcp_server::_write_complete_cb_args);
+}
+
+//攒写模式下本轮末尾由loop调用
+int tcp_conn::flush_output(){
+    _flush_pending = false;
+
+    int ret = _obuf.write2fd(_cfd);
+    if(ret == -1){
+        cerr << "Tcp_conn flush cfd error." << endl;
+        this->destroy_conn();
+        return 0;
+    }
+
+    //内核发送缓冲满了才挂EPOLLOUT，剩下的由写事件回调继续写
+    int left = _obuf.length();
+    if(left > 0)
+        _loop->add_io_event(_cfd, conn_wt_callback, EPOLLOUT, this);
+
+    this->check_low_water();
+    return left;
+}
+
 //销毁当前客户端连接
 void tcp_conn::destroy_conn(){
+    //已经销毁过
+    if(_cfd == -1)
+        return;
+
     //执行链接销毁的Hook函数
     if (tcp_server::_conn_close_cb != NULL) 
         tcp_server::_conn_close_cb(this, tcp_server::_conn_close_cb_args);
 
-    //将tcp_server中 把当前连接摘除
-    tcp_server::decrease_conn(_cfd);
+    //暂停读时还挂着恢复检查定时器
+    if(_resume_timer != -1){
+        _loop->cancel_timer(_resume_timer);
+        _resume_timer = -1;
+    }
+
+    //从所属loop的链接表中摘除，归还链接名额
+    _loop->del_conn(_cfd);
+    tcp_server::release_conn();
+    _loop->add_conn_count(-1);
 
-    //各种清理工作。下树、归还内存、关闭cfd
-    _loop->del_io_event(_cfd);
+    //各种清理工作。下树、归还内存、关闭cfd。暂停读期间fd可能已不在树上
+    if(_loop->is_listening(_cfd))
+        _loop->del_io_event(_cfd);
 
     _ibuf.clear();
     _obuf.clear();
+    _over_high = false;
 
     close(_cfd);
+    _cfd = -1;
+
+    //对象本身放到本轮末尾再释放：调用栈上层(do_read、路由回调等)在本轮内还会用到this。
+    //loop中的其他引用(flush列表、时间轮、跨线程消息)都是句柄，del_conn后已失效
+    _loop->add_task(conn_delete_task, this);
 }
 
+
+//暂停读
+void tcp_conn::pause_read(){
+    if(_resume_timer != -1)
+        return;
+
+    _loop->clear_io_mask(_cfd, EPOLLIN);
+    _resume_timer = _loop->run_after(READ_RESUME_MS, conn_resume_callback, this);
+}
+
+//恢复读。内存仍超过软上限就继续等
+void tcp_conn::resume_read(){
+    if(buf_pool::get_instance()->over_soft_limit()){
+        _resume_timer = _loop->run_after(READ_RESUME_MS, conn_resume_callback, this);
+        return;
+    }
+
+    //重新加入EPOLLIN时内核会检查一次就绪状态，暂停期间到达的数据(包括FIN)会马上触发读
+    _resume_timer = -1;
+    _loop->add_io_event(_cfd, conn_rd_callback, EPOLLIN, this);
+}
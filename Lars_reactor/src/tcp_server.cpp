@@ -7,37 +7,34 @@
 #include <unistd.h>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
 #include "tcp_server.h"
 #include "tcp_conn.h"
 #include "config_file.h"
 using namespace std;
 
 void accept_callback(event_loop* loop, int fd, void* args);
+void accept_task(event_loop* loop, void* args);
 
-//=======================链接相关函数========================
+//fd用光且没有预留fd时，暂停监听多久再试，毫秒
+#define ACCEPT_RETRY_MS 100
 
-void tcp_server::increase_conn(int cfd, tcp_conn* conn){
-    lock_guard<mutex> lock(_mutex);
-    conns[cfd]= conn;
-    ++_cur_conns;
-}
+//=======================链接相关函数========================
 
-void tcp_server::decrease_conn(int cfd){
-    lock_guard<mutex> lock(_mutex);
-    conns[cfd] = nullptr;
-    --_cur_conns;
+//链接名额在accept时已由reserve_conn占用，链接销毁时归还
+void tcp_server::release_conn(){
+    _cur_conns.fetch_sub(1);
 }
 
 void tcp_server::get_conn_num(int& cur_conn){   //传出参数
-    lock_guard<mutex> lock(_mutex);
-    cur_conn = _cur_conns;
+    cur_conn = _cur_conns.load();
 }
                                         
 //===============================================================
 
 //构造函数
 tcp_server::tcp_server(event_loop* loop, const char* ip, uint16_t port): 
-    _lfd(-1), _caddr(), _caddrlen(sizeof(_caddr)), _loop(loop)
+    _main_acceptor{this, loop, -1, -1, -1}, _loop(loop), _reuse_port(false), _accept_batch(64), _acceptors()
 {
     //0.忽略一些信号， 防止进程中断
     //  SIGHUP向断开的客户端发送数据，SIGPIPE向关闭的管道写数据
@@ -47,36 +44,27 @@ tcp_server::tcp_server(event_loop* loop, const char* ip, uint16_t port):
     if(signal(SIGPIPE, SIG_IGN) == SIG_ERR)
         cerr << "Signal ingore SIGPIPE error." << endl;
 
-    //1.创建监听套接字
-    _lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
-    if (_lfd == -1) {
-        cerr << "Lfd socket create error." << endl;
-        exit(1);
-    }
-
-    //2.绑定端口
+    //1.创建监听套接字并绑定端口
     struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
     saddr.sin_family = AF_INET;
     saddr.sin_port = htons(port);
     inet_pton(AF_INET, ip, &saddr.sin_addr);
 
-    //2.5设置_lfd可以重复监听（解决timewait2状态）
-    int op = 1;
-    if(setsockopt(_lfd, SOL_SOCKET, SO_REUSEADDR, &op, sizeof(op)) == -1)
-        cerr << "Setsocket reusedaddr error." << endl;
+    //多acceptor模式：每个工作线程一个SO_REUSEPORT监听套接字，主线程不监听
+    _reuse_port = config_file::instance()->GetBool("reactor", "reusePort", false);
 
-    if(bind(_lfd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1){
-        cerr << "Lfd bind error." << endl;
-        exit(1);
-    }
+    //每次唤醒最多accept多少个链接
+    _accept_batch = config_file::instance()->GetNumber("reactor", "acceptBatch", 64);
+    if(_accept_batch < 1)
+        _accept_batch = 1;
 
-    //3.开始监听
-    if(listen(_lfd, 128) == -1){
-        cerr << "Listen error." << endl;
-        exit(1);
-    }
+    //2.创建线程池。主线程和工作线程loop都按[reactor]配置(触发模式、epoll批量)初始化
+    _loop->load_config();
+
+    //内存池按配置预热，并在主线程loop上定时回收空闲内存
+    buf_pool::get_instance()->load_config(_loop);
 
-    //4.创建线程池
     int thread_cnt = config_file::instance()->GetNumber("reactor", "threadNums", 5);
     _thread_pool = make_unique<thread_pool>(thread_cnt);    //构造函数里已经有了cnt有效性判断
     if(_thread_pool == nullptr){
@@ -84,88 +72,243 @@ tcp_server::tcp_server(event_loop* loop, const char* ip, uint16_t port):
         exit(1);
     }
 
-    //5.创建链接管理
+    //3.创建链接管理
     _max_conns = config_file::instance()->GetNumber("reactor", "maxConns", 20);  
 
-    conns = new tcp_conn*[_max_conns + 5 + 2*thread_cnt];   //标准fd*3, 主线程epoll, lfd + (epoll+evfd)*工作线程数
-    if(!conns){
-        cerr << "new conns" << _max_conns << "error" << endl;
-        exit(1);
-    }                                           
+    //输出缓冲高低水位
+    _high_water = config_file::instance()->GetNumber("reactor", "outputHighWater", OUTPUT_HIGH_WATER / 1024) * 1024;
+    _low_water = config_file::instance()->GetNumber("reactor", "outputLowWater", 0) * 1024;
+    if(_low_water >= _high_water && _high_water > 0){
+        cerr << "Output low water must be below high water. Use 0." << endl;
+        _low_water = 0;
+    }
+
+    //空闲回收和心跳
+    _idle_ms = config_file::instance()->GetNumber("reactor", "idleTimeout", 0) * 1000ULL;
+    _heartbeat_msgid = config_file::instance()->GetNumber("reactor", "heartbeatMsgid", 0);
 
-    //6.注册lfd读事件。调用do_accpet的就是server，所以参数就是this
-    _loop->add_io_event(_lfd, accept_callback, EPOLLIN, this);
+    //4.注册lfd读事件
+    if(_reuse_port && thread_cnt > 0){
+        //每个工作线程各自监听、accept，内核按四元组哈希把新链接分给各个套接字
+        _acceptors.resize(thread_cnt);
+        for(int i = 0; i < thread_cnt; ++i){
+            _acceptors[i] = create_acceptor(_thread_pool->get_loop(i), saddr, true);
+            acceptor* acc = &_acceptors[i];
+
+            //工作线程可能已经进入event_process，也可能还没有。注册总是投递到它的收件箱，
+            //由它自己的线程执行，主线程不碰工作loop的handler数组和epoll
+            acc->loop->queue_in_loop([acc](event_loop* loop){
+                loop->add_io_event(acc->lfd, accept_callback, EPOLLIN, acc);
+            });
+        }
+    }
+    else{
+        //主线程accept，再分发给线程池
+        _reuse_port = false;
+        _main_acceptor = create_acceptor(_loop, saddr, false);
+        _loop->add_io_event(_main_acceptor.lfd, accept_callback, EPOLLIN, &_main_acceptor);
+    }
 
 
     cout << "******************TCP server create succ. Ip:" << ip << " ,port:" << port << "******************"<< endl;
 }
 
-//提供创建连接的服务
-void tcp_server::do_accept()
-{
-    int cfd = -1;
+//创建一个绑定到saddr的非阻塞监听套接字
+int tcp_server::create_listen_fd(const struct sockaddr_in& saddr, bool reuse_port){
+    //非阻塞：ET模式accept到EAGAIN为止，阻塞套接字会卡在最后一次accept上
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd == -1) {
+        cerr << "Lfd socket create error." << endl;
+        exit(1);
+    }
+
+    //设置lfd可以重复监听（解决timewait2状态）
+    int op = 1;
+    if(setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &op, sizeof(op)) == -1)
+        cerr << "Setsocket reusedaddr error." << endl;
+
+    //多个套接字绑定同一端口，每个都有自己的accept队列
+    if(reuse_port && setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &op, sizeof(op)) == -1){
+        cerr << "Setsocket reuseport error." << endl;
+        exit(1);
+    }
+
+    if(bind(lfd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1){
+        cerr << "Lfd bind error." << endl;
+        exit(1);
+    }
+
+    //开始监听
+    if(listen(lfd, 128) == -1){
+        cerr << "Listen error." << endl;
+        exit(1);
+    }
+
+    return lfd;
+}
+
+//从acc->lfd上取一个新链接，没有新链接(或无法继续)返回-1，fd用光拒绝了一个链接返回-2。新链接已是非阻塞
+int tcp_server::accept_fd(acceptor* acc, struct sockaddr_in* caddr){
     while(1){
-        cout << "Start accepting." << endl;
-        cfd = accept(_lfd, (struct sockaddr*)&_caddr, &_caddrlen);
-        if(cfd == -1){
-            if(errno == EINTR){    //非致命信号，可恢复继续。如SIGALRM，SIFCHLD
-                cerr << "Accept errno = EINTR." << endl;
-                continue;
-            }
-            else if(errno == EAGAIN){   //循环的出口，无论是LT还是ET
-                cerr << "Accept errno = EAGAIN." << endl;
-                break;
-            }
-            else if(errno == EMFILE){
-                cerr << "Accept errno = EMFILE." << endl;
-                continue;
-            }
-            else{
-                cerr << "Accept error." << endl;
-                exit(1);
+        socklen_t caddrlen = sizeof(*caddr);
+        //accept4直接带上非阻塞和close-on-exec，tcp_conn中不再需要两次fcntl
+        int cfd = accept4(acc->lfd, (struct sockaddr*)caddr, &caddrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(cfd != -1)
+            return cfd;
+
+        if(errno == EINTR){    //非致命信号，可恢复继续。如SIGALRM，SIFCHLD
+            continue;
+        }
+        else if(errno == EAGAIN){   //循环的出口，无论是LT还是ET
+            return -1;
+        }
+        else if(errno == ECONNABORTED || errno == EPROTO){  //客户端在accept前就断开了，取下一个
+            continue;
+        }
+        else if(errno == EMFILE || errno == ENFILE){
+            //fd用光。链接一直留在accept队列里，LT模式会不停通知，直接continue会死循环。
+            //释放预留fd腾出一个位置，accept后立刻关掉，让客户端明确知道被拒绝，再把预留fd占回来
+            //上次没能把预留fd占回来，先再试一次
+            if(acc->idle_fd == -1)
+                acc->idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if(acc->idle_fd == -1){
+                //没法拒绝链接，lfd一直可读，LT模式下会空转。先停止监听，过一会儿再试
+                cerr << "Accept errno = EMFILE. No reserve fd left. Pause accepting." << endl;
+                pause_accept(acc);
+                return -1;
             }
+            close(acc->idle_fd);
+            int shed_fd = accept(acc->lfd, NULL, NULL);
+            if(shed_fd != -1)
+                close(shed_fd);
+            acc->idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+            //队列为空时accept也返回EMFILE，这时已经没有可拒绝的链接了
+            if(shed_fd == -1)
+                return -1;
+            //拒绝一个算一次accept，受_accept_batch限制，不在这里一口气把整个队列都拒掉
+            cerr << "Accept errno = EMFILE. Shed one connection." << endl;
+            return -2;
+        }
+        else if(errno == ENOBUFS || errno == ENOMEM){
+            //内存不足，这一轮先不取了。ET模式下lfd不会再通知，暂停监听，到时重新挂上
+            cerr << "Accept errno = ENOMEM. Pause accepting." << endl;
+            pause_accept(acc);
+            return -1;
         }
         else{
-            //判断链接个数是否已超最大值
-            int cur_conns;
-            get_conn_num(cur_conns);
-            if(cur_conns >= _max_conns){
-                cerr << "Too much connections. Max: " << _max_conns;
-                close(cfd);
-            }
-            else{
-                //============新链接将由线程池处理===========
-                if(_thread_pool){  
-                    //多线程模式
-                    //1. 获得一个线程来处理
-                    thread_queue<msg_task>* thread_queue = _thread_pool->get_thread();
-                    //2. 创建一个新链接的消息任务
-                    msg_task task{msg_task::NEW_CONN, cfd};
-                    //3. 添加到消息队列中，对应event_loop检测evfd读事件，让thread来处理
-                    thread_queue->send(task);
-                }
-                else{        //这里应该是初始化线程池失败，不用exit而是throw的情况
-                    //启动单线程模式
-                    tcp_conn* conn= new tcp_conn(cfd, _loop);
-                    if(conn == NULL){
-                        cerr << "New tcp_conn error!" << endl;
-                        break;
-                    }
-                }
-            }
-            break;  //水平模式会卡在accept，eagain是到不了的，必须break
+            cerr << "Accept error." << endl;
+            exit(1);
+        }
+    }
+}
+
+//暂停监听acc->lfd，定时器到时恢复
+void tcp_server::pause_accept(acceptor* acc){
+    if(acc->retry_timer != -1)
+        return;
+
+    acc->loop->clear_io_mask(acc->lfd, EPOLLIN);
+    acc->retry_timer = acc->loop->run_after(ACCEPT_RETRY_MS, resume_accept, acc);
+}
+
+//恢复监听。重新加入EPOLLIN时内核检查一次就绪状态，暂停期间排队的链接会马上触发accept
+void tcp_server::resume_accept(event_loop* loop, void* args){
+    acceptor* acc = (acceptor*)args;
+    acc->retry_timer = -1;
+    loop->add_io_event(acc->lfd, accept_callback, EPOLLIN, acc);
+}
+
+//占用一个链接名额，已满返回false。多个acceptor线程同时accept，检查和计数必须是一个原子操作
+bool tcp_server::reserve_conn(){
+    if(_cur_conns.fetch_add(1) >= _max_conns){
+        _cur_conns.fetch_sub(1);
+        cerr << "Too much connections. Max: " << _max_conns << endl;
+        return false;
+    }
+    return true;
+}
+
+//提供创建连接的服务。主线程监听套接字
+void tcp_server::do_accept()
+{
+    do_accept(&_main_acceptor);
+}
+
+//从acc->lfd上批量accept。每次唤醒最多取_accept_batch个，一直取到EAGAIN为止
+void tcp_server::do_accept(acceptor* acc)
+{
+    struct sockaddr_in caddr;
+    for(int n = 0; n < _accept_batch; ++n){
+        int cfd = accept_fd(acc, &caddr);
+        if(cfd == -1)
+            return;
+        if(cfd == -2)       //fd用光，拒绝了一个链接
+            continue;
+
+        //判断链接个数是否已超最大值
+        if(!reserve_conn()){
+            close(cfd);
+            continue;
+        }
+
+        if(_reuse_port){
+            //多acceptor模式：链接直接在本工作线程建立，不经过主线程和thread_queue
+            acc->loop->add_conn_count(1);
+            new tcp_conn(cfd, acc->loop);
+        }
+        else if(_thread_pool){
+            //============新链接将由线程池处理===========
+            //1. 获得一个线程来处理
+            thread_queue<msg_task>* thread_queue = _thread_pool->get_thread(caddr.sin_addr.s_addr);
+            //2. 创建一个新链接的消息任务
+            msg_task task{msg_task::NEW_CONN, cfd};
+            //3. 添加到消息队列中，对应event_loop检测evfd读事件，让thread来处理
+            thread_queue->send(task);
+        }
+        else{        //这里应该是初始化线程池失败，不用exit而是throw的情况
+            //启动单线程模式
+            _loop->add_conn_count(1);
+            new tcp_conn(cfd, _loop);
         }
     }
+
+    //取满一批还没到EAGAIN。LT模式下一轮epoll_wait会再通知；
+    //ET模式不会再通知，放到本轮末尾接着取，先让本轮其他事件得到处理
+    if(acc->loop->is_edge_trigger(acc->lfd))
+        acc->loop->add_task(accept_task, acc);
 }
-    
+
 //析构函数，资源释放
 tcp_server::~tcp_server()
 {
-    close(_lfd);
+    close_acceptor(_main_acceptor);
+    for(auto& acc : _acceptors)
+        close_acceptor(acc);
+}
+
+//创建一个acceptor：监听套接字+预留fd
+tcp_server::acceptor tcp_server::create_acceptor(event_loop* loop, const struct sockaddr_in& saddr, bool reuse_port){
+    int lfd = create_listen_fd(saddr, reuse_port);
+    //预留一个空闲fd，fd用光时释放它来拒绝链接
+    int idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return acceptor{this, loop, lfd, idle_fd, -1};
+}
+
+void tcp_server::close_acceptor(acceptor& acc){
+    if(acc.lfd != -1)
+        close(acc.lfd);
+    if(acc.idle_fd != -1)
+        close(acc.idle_fd);
 }
 
 void accept_callback(event_loop* loop, int fd, void* args){
-    tcp_server* server = (tcp_server*)args;
-    server->do_accept();
+    tcp_server::acceptor* acc = (tcp_server::acceptor*)args;
+    acc->server->do_accept(acc);
 }
 
+//ET模式下一批没取完，本轮末尾接着取
+void accept_task(event_loop* loop, void* args){
+    tcp_server::acceptor* acc = (tcp_server::acceptor*)args;
+    acc->server->do_accept(acc);
+}
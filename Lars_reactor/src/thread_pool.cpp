@@ -1,7 +1,10 @@
 #include <queue>
 #include <iostream>
 #include <cstring>
+#include <climits>
+#include <arpa/inet.h>
 #include "thread_pool.h"
+#include "config_file.h"
 using namespace std;
 
 //一旦有task业务任务过来，loop检测到并执行的回调函数。读出队列里的消息并处理
@@ -9,9 +12,9 @@ void deal_task(event_loop* loop, int fd, void* args){
     //1. 从queue中取数据(注意，变量名不能是queue，冲突，否则需要加std::)
     thread_queue<msg_task>* origin_queue = (thread_queue<msg_task>*) args;
 
-    //双缓冲减少锁粒度、减少主线程send阻塞
+    //一次取走所有已到达的任务，主线程send无锁，不会被这里阻塞
     queue<msg_task> tmp_queue;
-    origin_queue->recv(tmp_queue); //recv内部使用swap，把空线程给到thread_queue继续接收新任务
+    origin_queue->recv(tmp_queue);
 
     //2. 依次处理每个任务
     while(!tmp_queue.empty()){
@@ -57,12 +60,22 @@ thread_pool::thread_pool(int thread_cnt):
     _thread_cnt(thread_cnt),
     _tids(thread_cnt),
     _index(0),
+    _policy(DISPATCH_RR),
     _conns()
 {
     //这里不再需要判断thread_cnt是否小于0，初始化列表已判断。
 
     //开辟_queues指针数组和_tid内存数组也已在初始化列表中完成，vector初始化
 
+    //新链接分配策略，默认轮询
+    string policy = config_file::instance()->GetString("reactor", "dispatch", "rr");
+    if(policy == "least")
+        _policy = DISPATCH_LEAST;
+    else if(policy == "iphash")
+        _policy = DISPATCH_IPHASH;
+    else if(policy != "rr")
+        cerr << "Unknown dispatch policy " << policy << ", use rr." << endl;
+
     //遍历_queues,_loops并进行线程初始化
     for(int i = 0; i < thread_cnt; ++i){
         //1. 开辟并初始化queue、loop对象。
@@ -72,6 +85,9 @@ thread_pool::thread_pool(int thread_cnt):
         _queues[i] = make_unique<thread_queue<msg_task>>();  
         //_queue[i] = unique_ptr<thread_queue<msg_task>>(new thread_queue<msg_task>);也可以，但繁琐，写两次类型
 
+        //线程启动前读取loop配置(触发模式、epoll批量)，之后注册的fd都按该模式上树
+        _loops[i]->load_config();
+
         //2. queue绑定到对应loop
         _queues[i]->set_loop(_loops[i].get());
         _queues[i]->set_callback(deal_task, _queues[i].get());
@@ -102,14 +118,38 @@ thread_pool::thread_pool(int thread_cnt):
     return;
 }
 
-//提供一个循环获取thread_queue的方法
-thread_queue<msg_task>* thread_pool:: get_thread(){
-    if(_index == _thread_cnt)
-        _index = 0;
+//按分配策略获取一个thread_queue
+thread_queue<msg_task>* thread_pool:: get_thread(uint32_t client_ip){
+    int index = 0;
+    switch(_policy){
+    case DISPATCH_LEAST:
+        //链接数相同时从轮询位置开始找，避免全部落到0号线程
+        for(int i = 0, min_cnt = INT_MAX; i < _thread_cnt; ++i){
+            int cur = (_index + i) % _thread_cnt;
+            int cnt = _loops[cur]->conn_count();
+            if(cnt < min_cnt){
+                min_cnt = cnt;
+                index = cur;
+            }
+        }
+        _index = (index + 1) % _thread_cnt;
+        break;
+    case DISPATCH_IPHASH:
+        //client_ip是网络字节序，先转成主机序，低位才是变化多的末段。
+        //乘法哈希把变化搅到高位，取高16位再取模：低位只由ip的低位决定，线程数是2的幂时同网段会全落在一个线程
+        index = (((uint32_t)ntohl(client_ip) * 2654435761u) >> 16) % _thread_cnt;
+        break;
+    default:
+        if(_index >= _thread_cnt)
+            _index = 0;
+        index = _index++;
+        break;
+    }
 
-    cout << "Get working thread num: " << _index+1 << " dealing...."  << endl;
+    //分配时就计数，否则连续accept时工作线程还没建好链接，least会一直选同一个线程
+    _loops[index]->add_conn_count(1);
 
-    return _queues[_index++].get();
+    return _queues[index].get();
 }
 
 void thread_pool::send_task(task_callback task_cb, void* args){
@@ -122,3 +162,18 @@ void thread_pool::send_task(task_callback task_cb, void* args){
     }
 }
 
+//获取每个工作线程当前的链接数
+void thread_pool::get_conn_counts(std::vector<int>& counts){
+    counts.resize(_thread_cnt);
+    for(int i = 0; i < _thread_cnt; ++i){
+        counts[i] = _loops[i]->conn_count();
+    }
+}
+
+//获取每个工作线程loop的运行统计，统计量为原子变量，可在主线程直接读取
+void thread_pool::get_loop_stats(std::vector<loop_stats>& stats){
+    stats.resize(_thread_cnt);
+    for(int i = 0; i < _thread_cnt; ++i){
+        _loops[i]->get_stats(stats[i]);
+    }
+}
@@ -0,0 +1,101 @@
+#include "timer_queue.h"
+#include <algorithm>
+#include <functional>
+#include <time.h>
+
+timer_queue::timer_queue(): _heap(), _timers(), _next_id(0){
+}
+
+//当前单调时钟，ms。不受系统改时间影响
+uint64_t timer_queue::now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//添加一个定时器，返回定时器id
+int timer_queue::add_timer(uint64_t expire, uint64_t interval, timer_callback cb, void* args){
+    //id单调递增，回绕后跳过0和仍在使用的id
+    do{
+        if(++_next_id <= 0)
+            _next_id = 1;
+    }while(_timers.find(_next_id) != _timers.end());
+
+    int id = _next_id;
+    _timers[id] = timer_event{expire, interval, cb, args};
+
+    _heap.push_back(heap_node{expire, id});
+    push_heap(_heap.begin(), _heap.end(), greater<heap_node>());
+
+    return id;
+}
+
+//删除一个定时器
+void timer_queue::del_timer(int timer_id){
+    if(_timers.erase(timer_id) == 0)
+        return;
+
+    //堆中无效节点超过一半时重建
+    if(_heap.size() > 64 && _heap.size() > 2 * _timers.size())
+        rebuild_heap();
+}
+
+//距离最早到期还有多少ms
+int timer_queue::next_timeout(uint64_t now){
+    //先把堆顶已删除的节点弹掉
+    while(!_heap.empty()){
+        auto it = _timers.find(_heap.front().id);
+        if(it != _timers.end() && it->second.expire == _heap.front().expire)
+            break;
+        pop_heap(_heap.begin(), _heap.end(), greater<heap_node>());
+        _heap.pop_back();
+    }
+
+    if(_heap.empty())
+        return -1;
+
+    uint64_t expire = _heap.front().expire;
+    if(expire <= now)
+        return 0;
+    return (int)min<uint64_t>(expire - now, 0x7fffffff);
+}
+
+//执行所有已到期的定时器
+void timer_queue::run_expired(event_loop* loop, uint64_t now){
+    while(!_heap.empty() && _heap.front().expire <= now){
+        heap_node node = _heap.front();
+        pop_heap(_heap.begin(), _heap.end(), greater<heap_node>());
+        _heap.pop_back();
+
+        //已删除(或已被重新调度)的节点，跳过
+        auto it = _timers.find(node.id);
+        if(it == _timers.end() || it->second.expire != node.expire)
+            continue;
+
+        //先拷贝出来再执行。回调中可能增删定时器导致迭代器失效
+        timer_event timer = it->second;
+        if(timer.interval > 0){
+            //重复定时器以本次到期时间为基准，避免误差累积；落后太多则从now重新算
+            uint64_t next = timer.expire + timer.interval;
+            if(next <= now)
+                next = now + timer.interval;
+            it->second.expire = next;
+            _heap.push_back(heap_node{next, node.id});
+            push_heap(_heap.begin(), _heap.end(), greater<heap_node>());
+        }
+        else{
+            _timers.erase(it);
+        }
+
+        timer.cb(loop, timer.args);
+    }
+}
+
+//重建堆，去掉所有已删除节点
+void timer_queue::rebuild_heap(){
+    _heap.clear();
+    for(auto& it : _timers){
+        _heap.push_back(heap_node{it.second.expire, it.first});
+    }
+    make_heap(_heap.begin(), _heap.end(), greater<heap_node>());
+}
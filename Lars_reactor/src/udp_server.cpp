@@ -1,4 +1,5 @@
 #include "udp_server.h"
+#include "frame_decoder.h"
 #include <iostream>
 #include <signal.h>
 #include <errno.h>
@@ -49,7 +50,6 @@ udp_server::udp_server(event_loop* loop, const char* ip, uint16_t port):
 
 //主动发消息方法
 int udp_server::conn_write2fd(const char* data, int msglen, int msgid){
-    memset(_write_buf, 0, sizeof(_write_buf));
     if(msglen > MESSAGE_LENGTH_LIMIT){
         cerr << "Send message too large." << endl;
         return -1;
@@ -88,17 +88,14 @@ void udp_server::do_read(){
             }
         }
 
-        msg_head head;
-        //得到消息头（事实上udp应该隐去）
-        memcpy(&head, _read_buf, MESSAGE_HEAD_LEN);
-
-        if(head.msglen > MESSAGE_LENGTH_LIMIT || head.msglen < 0 || head.msglen + MESSAGE_HEAD_LEN != pkg_len){
+        //一个报文就是一个完整消息，长度由报文边界校验，不需要清空缓冲
+        int ret = decode_datagram(_read_buf, pkg_len, [this](int msgid, int msglen, const char* data){
+            _router.call(msgid, msglen, data, this);
+        });
+        if(ret == -1){
             cerr << "Received invalid data." << endl;
             return;
         }
-
-        _router.call(head.msgid, head.msglen, _read_buf + MESSAGE_HEAD_LEN, this);
-        memset(_read_buf, 0, sizeof(_write_buf));
     }
 }
 
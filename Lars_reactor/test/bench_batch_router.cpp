@@ -0,0 +1,130 @@
+#include "test_util.h"
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <poll.h>
+using namespace std;
+
+//批量路由对比：两个工作线程共享一张受锁保护的计数表(模拟共享的路由表/统计)，客户端每次发PIPELINE个请求，每个请求回一个消息。
+//msgid 1 普通路由：每个消息加一次锁；msgid 2 批量路由：一次读到的同一msgid的消息一批只加一次锁。
+//统计每秒回复数和每个请求的加锁次数。
+
+const char* IP = "127.0.0.1";
+const int PORT = 7796;
+const char* CONF = "/tmp/bench_batch_router.ini";
+const int CONNS = 4;
+const int PIPELINE = 64;        //每次发送的请求数
+const int REPLY_LEN = 8;        //回复消息体长度
+const int SECS = 2;
+
+mutex g_lock;
+long g_table[64];
+atomic<long> g_locks(0);
+
+//普通路由：每个请求加一次锁
+void per_frame(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    {
+        lock_guard<mutex> guard(g_lock);
+        ++g_locks;
+        ++g_table[len % 64];
+    }
+    char reply[REPLY_LEN] = {0};
+    conn->conn_write2fd(reply, REPLY_LEN, msgid);
+}
+
+//批量路由：整批加一次锁
+void per_batch(const msg_frame* frames, int count, int msgid, net_connection* conn, void* usr_data){
+    {
+        lock_guard<mutex> guard(g_lock);
+        ++g_locks;
+        for(int i = 0; i < count; ++i)
+            ++g_table[frames[i].len % 64];
+    }
+    char reply[REPLY_LEN] = {0};
+    for(int i = 0; i < count; ++i)
+        conn->conn_write2fd(reply, REPLY_LEN, msgid);
+}
+
+//用msgid的请求压测SECS秒，返回每秒回复数，replies传出回复总数
+double run(const vector<int>& fds, int msgid, long& replies){
+    vector<char> batch;
+    msg_head head{(int)htonl(msgid), (int)htonl(0)};
+    for(int i = 0; i < PIPELINE; ++i)
+        batch.insert(batch.end(), (char*)&head, (char*)&head + MESSAGE_HEAD_LEN);
+    const long batch_reply_bytes = (long)PIPELINE * (MESSAGE_HEAD_LEN + REPLY_LEN);
+
+    vector<long> pending(fds.size(), 0);    //每个链接还没收完的回复字节
+    long recvd = 0;
+    auto start = chrono::steady_clock::now();
+    auto end = start + chrono::seconds(SECS);
+    while(chrono::steady_clock::now() < end){
+        for(size_t i = 0; i < fds.size(); ++i){
+            if(pending[i] == 0){
+                if(write(fds[i], batch.data(), batch.size()) != (int)batch.size())
+                    cerr << "Write error." << endl;
+                pending[i] = batch_reply_bytes;
+            }
+        }
+
+        vector<struct pollfd> pfds;
+        for(int fd : fds)
+            pfds.push_back({fd, POLLIN, 0});
+        poll(pfds.data(), pfds.size(), 100);
+        for(size_t i = 0; i < fds.size(); ++i){
+            if(!(pfds[i].revents & POLLIN))
+                continue;
+            char sink[65536];
+            int ret = read(fds[i], sink, sizeof(sink));
+            if(ret > 0){
+                pending[i] -= ret;
+                recvd += ret;
+            }
+        }
+    }
+
+    //收完在途的回复
+    for(size_t i = 0; i < fds.size(); ++i){
+        while(pending[i] > 0){
+            char sink[65536];
+            int ret = read(fds[i], sink, min<long>(sizeof(sink), pending[i]));
+            if(ret <= 0)
+                break;
+            pending[i] -= ret;
+            recvd += ret;
+        }
+    }
+    replies = recvd / (MESSAGE_HEAD_LEN + REPLY_LEN);
+    return replies / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 64\nthreadNums = 2\n");
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+
+    event_loop* loop;
+    tcp_server* server = new_server(IP, PORT, &loop);
+    server->add_msg_router(1, per_frame);
+    server->add_batch_router(2, per_batch);
+    run_loop(loop);
+
+    vector<int> fds;
+    for(int i = 0; i < CONNS; ++i)
+        fds.push_back(connect_server(IP, PORT));
+    cout.rdbuf(cout_buf);
+    cout << CONNS << " conns on 2 workers, " << PIPELINE << " pipelined requests, shared table behind one mutex" << endl;
+
+    for(int msgid : {1, 2}){
+        long locks0 = g_locks;
+        long replies;
+        double rps = run(fds, msgid, replies);
+        cout << (msgid == 1 ? "per-frame route: " : "batch route    : ") << rps << " replies/s, "
+             << (double)(g_locks - locks0) / replies << " lock acquisitions/request" << endl;
+    }
+
+    cout.rdbuf(nullptr);
+    for(int fd : fds)
+        close(fd);
+    return 0;
+}
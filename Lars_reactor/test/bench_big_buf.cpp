@@ -0,0 +1,110 @@
+#include "buf_arena.h"
+#include "buf_pool.h"
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <sys/resource.h>
+using namespace std;
+
+//大块内存对比：每块单独new char[] vs buf_arena(mmap整片区域+MADV_HUGEPAGE)。
+//申请一组1M/4M/8M的块，反复在块之间拷贝大的路由包，统计缺页次数、常驻内存、大页内存和耗时，
+//最后全部归还，看常驻内存是否还给系统。
+
+const int ROUNDS = 200;             //拷贝轮数
+const int PAYLOAD = 768 * 1024;     //每次拷贝的路由包大小
+
+//一组大块：16个1M，8个4M，4个8M，共80MB
+const vector<int> CAPS = []{
+    vector<int> caps;
+    caps.insert(caps.end(), 16, m1M);
+    caps.insert(caps.end(), 8, m4M);
+    caps.insert(caps.end(), 4, m8M);
+    return caps;
+}();
+
+long minor_faults(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+//从/proc/self/smaps_rollup读某一项(kB)
+long proc_kb(const char* file, const char* key){
+    ifstream in(file);
+    string line;
+    size_t klen = strlen(key);
+    while(getline(in, line)){
+        if(line.compare(0, klen, key) == 0)
+            return atol(line.c_str() + klen);
+    }
+    return -1;
+}
+
+struct result{
+    long faults;
+    long rss_kb;
+    long huge_kb;
+    double ms;
+    long rss_after_kb;
+};
+
+//ALLOC/FREE 申请、归还一块内存
+template<typename ALLOC, typename FREE>
+result run(ALLOC alloc_mem, FREE free_mem){
+    result r;
+    long faults0 = minor_faults();
+    auto start = chrono::steady_clock::now();
+
+    vector<char*> blocks;
+    for(int cap : CAPS)
+        blocks.push_back(alloc_mem(cap));
+
+    //每轮把每块开头的路由包拷到下一块的随机偏移处
+    unsigned seed = 1;
+    for(int r = 0; r < ROUNDS; ++r){
+        for(size_t i = 0; i < blocks.size(); ++i){
+            size_t j = (i + 1) % blocks.size();
+            seed = seed * 1103515245 + 12345;
+            int off = seed % (CAPS[j] - PAYLOAD + 1);
+            memcpy(blocks[j] + off, blocks[i], PAYLOAD);
+        }
+    }
+
+    r.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    r.faults = minor_faults() - faults0;
+    r.rss_kb = proc_kb("/proc/self/status", "VmRSS:");
+    r.huge_kb = proc_kb("/proc/self/smaps_rollup", "AnonHugePages:");
+
+    for(size_t i = 0; i < blocks.size(); ++i)
+        free_mem(blocks[i], CAPS[i]);
+    r.rss_after_kb = proc_kb("/proc/self/status", "VmRSS:");
+    return r;
+}
+
+void print(const char* name, const result& r){
+    cout << name << ": " << r.faults << " minor faults, rss " << r.rss_kb << " kB (hugepages " << r.huge_kb
+         << " kB), " << r.ms << " ms, rss after free " << r.rss_after_kb << " kB" << endl;
+}
+
+int main(){
+    long base = proc_kb("/proc/self/status", "VmRSS:");
+    cout << "base rss " << base << " kB, 80MB of 1M/4M/8M blocks, " << ROUNDS << " rounds of "
+         << PAYLOAD / 1024 << "K copies" << endl;
+
+    result heap = run([](int cap){ return new char[cap]; }, [](char* p, int cap){ delete[] p; });
+    print("new char[]", heap);
+
+    buf_arena arena;
+    result ar = run([&arena](int cap){ return arena.alloc(cap); }, [&arena](char* p, int cap){ arena.revert(p, cap); });
+    print("buf_arena ", ar);
+
+    arena_stat st;
+    arena.get_stats(st);
+    cout << "arena: " << st.regions << " regions, " << st.mapped_kb << " kB mapped, MADV_HUGEPAGE "
+         << (st.huge ? "ok" : "unsupported, normal pages") << endl;
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "buf_pool.h"
+#include <unordered_map>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <iostream>
+using namespace std;
+
+//内存池多线程申请/归还吞吐对比：线程缓存 vs 旧实现(每次都加全局锁+unordered_map查找)。
+//每个线程模拟一个event_loop：每轮申请HOLD块(读缓冲、写缓冲混合刻度)，写一个字节，再全部归还。
+//最后输出各刻度线程缓存命中率，并演示突发申请后定时回收(trim)把空闲内存还给系统。
+
+const int OPS = 2000000;        //每轮申请总次数，平均分给各线程
+const int HOLD = 8;             //每轮同时持有的块数
+
+//旧实现，作为对比基准
+class mutex_pool{
+public:
+    mutex_pool(){
+        for(int cap : {m4K, m16K, m64K})
+            for(int i = 0; i < 1000; ++i)
+                revert(new io_buf(cap));
+    }
+    io_buf* alloc_buf(int N){
+        int index = N <= m4K ? m4K : (N <= m16K ? m16K : m64K);
+        unique_lock<mutex> lock(_mutex);
+        io_buf* target = _pool[index];
+        if(!target)
+            return new io_buf(index);
+        _pool[index] = target->next;
+        target->next = nullptr;
+        return target;
+    }
+    void revert(io_buf* buffer){
+        buffer->head = buffer->length = 0;
+        unique_lock<mutex> lock(_mutex);
+        buffer->next = _pool[buffer->capacity];
+        _pool[buffer->capacity] = buffer;
+    }
+private:
+    unordered_map<int, io_buf*> _pool;
+    mutex _mutex;
+};
+
+//每个线程交替申请的大小：消息、读缓冲、偶尔的大响应
+const int SIZES[HOLD] = {100, 4096, 1400, 8000, 200, 4096, 60000, 512};
+
+template<typename POOL>
+double run_round(POOL* pool, int threads){
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int t = 0; t < threads; ++t){
+        ts.emplace_back([pool, threads](){
+            io_buf* held[HOLD];
+            for(int r = 0; r < OPS / threads / HOLD; ++r){
+                for(int i = 0; i < HOLD; ++i){
+                    held[i] = pool->alloc_buf(SIZES[i]);
+                    held[i]->data[0] = (char)i;
+                    held[i]->length = 1;
+                }
+                for(int i = 0; i < HOLD; ++i)
+                    pool->revert(held[i]);
+            }
+        });
+    }
+    for(auto& t : ts)
+        t.join();
+    auto end = chrono::steady_clock::now();
+    return OPS / chrono::duration<double, micro>(end - start).count();
+}
+
+//当前进程常驻内存(kB)
+long rss_kb(){
+    ifstream status("/proc/self/status");
+    string line;
+    while(getline(status, line)){
+        if(line.compare(0, 6, "VmRSS:") == 0)
+            return atol(line.c_str() + 6);
+    }
+    return -1;
+}
+
+int main(){
+    mutex_pool* old_pool = new mutex_pool();
+    buf_pool* pool = buf_pool::get_instance();
+
+    for(int threads : {1, 2, 4, 8}){
+        double mtx = run_round(old_pool, threads);
+        double cached = run_round(pool, threads);
+        cout << threads << " threads: global mutex " << mtx << " M ops/s, thread cache " << cached << " M ops/s" << endl;
+    }
+
+    //工作线程都已退出，统计已全部汇总
+    vector<buf_class_stat> stats;
+    pool->get_stats(stats);
+    for(auto& st : stats){
+        if(st.allocs == 0)
+            continue;
+        cout << "class " << st.cap / 1024 << "K: " << st.allocs << " allocs, hit rate "
+             << 100.0 * st.hits / st.allocs << "%" << endl;
+    }
+
+    //突发：一次持有2000块64K，写满后全部归还
+    const int BURST = 2000;
+    vector<io_buf*> burst(BURST);
+    for(auto& buf : burst){
+        buf = pool->alloc_buf(m64K);
+        memset(buf->data, 1, buf->capacity);
+    }
+    for(auto buf : burst)
+        pool->revert(buf);
+    long before = rss_kb();
+
+    //第一次trim只重置"周期内最少空闲块数"，第二次才释放整个周期都没被用过的块
+    pool->trim();
+    pool->trim();
+    pool->get_stats(stats);
+    cout << "after " << BURST << " x 64K burst: rss " << before << " kB, after trim " << rss_kb()
+         << " kB, 64K blocks left in pool " << stats[2].pooled << endl;
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "test_util.h"
+#include <vector>
+#include <atomic>
+#include <signal.h>
+#include <sys/wait.h>
+using namespace std;
+
+//建链风暴测试：对比单lfd(主线程accept+thread_queue分发) 与 reusePort(每个工作线程各自accept)，
+//以及每次唤醒只accept一个(acceptBatch=1，旧行为) 与 批量accept。
+//子进程按各模式起服务器，父进程多线程不停地 一次建BURST个链 -> 每个发一个消息 -> 收齐回显 -> 全部断开，
+//统计每秒完成的链接数。BURST个链接几乎同时到达，accept队列中有大量待取链接。
+//用法: ./bench_conn_storm [client_threads] [seconds]
+
+const char* IP = "127.0.0.1";
+const int PORT = 7790;
+const char* CONF = "/tmp/bench_conn_storm.ini";
+const int BURST = 32;       //每个客户端线程一次同时建立的链接数。线程数*BURST不要超过listen队列长度128
+
+void echo_busi(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    conn->conn_write2fd(data, len, msgid);
+}
+
+//子进程：按配置起服务器
+void run_server(bool reuse_port, int accept_batch){
+    write_reactor_conf(CONF, string("maxConns = 4096\nthreadNums = 4\nreusePort = ") + (reuse_port ? "true" : "false")
+                             + "\nacceptBatch = " + to_string(accept_batch) + "\n");
+
+    //服务器日志很多，不计入测试
+    freopen("/dev/null", "w", stdout);
+
+    event_loop loop;
+    tcp_server server(&loop, IP, PORT);
+    server.add_msg_router(1, echo_busi);
+    loop.event_process();
+}
+
+//建BURST个链，每个发一个消息，收齐回显后全部断开。返回成功的链接数
+int burst_conns(const struct sockaddr_in& saddr, int burst){
+    vector<int> fds;
+    for(int i = 0; i < burst; ++i){
+        //connect在三次握手完成、进入服务器accept队列后就返回，不等服务器accept
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1){
+            close(fd);
+            continue;
+        }
+        fds.push_back(fd);
+    }
+
+    char buf[MESSAGE_HEAD_LEN + 4];
+    msg_head head{(int)htonl(1), (int)htonl(4)};
+    memcpy(buf, &head, MESSAGE_HEAD_LEN);
+    memcpy(buf + MESSAGE_HEAD_LEN, "ping", 4);
+    for(int fd : fds){
+        if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+            cerr << "Write error." << endl;
+    }
+
+    int ok = 0;
+    for(int fd : fds){
+        int got = 0;
+        while(got < (int)sizeof(buf)){
+            int ret = read(fd, buf + got, sizeof(buf) - got);
+            if(ret <= 0)
+                break;
+            got += ret;
+        }
+        if(got == sizeof(buf))
+            ++ok;
+        close(fd);
+    }
+    return ok;
+}
+
+double run_mode(bool reuse_port, int accept_batch, int client_threads, int seconds){
+    pid_t pid = fork();
+    if(pid == 0){
+        run_server(reuse_port, accept_batch);
+        exit(0);
+    }
+
+    struct sockaddr_in saddr = server_addr(IP, PORT);
+
+    //等服务器起来
+    while(burst_conns(saddr, 1) != 1)
+        this_thread::sleep_for(chrono::milliseconds(10));
+
+    atomic<long> done(0), failed(0);
+    atomic<bool> stop(false);
+    vector<thread> threads;
+    for(int i = 0; i < client_threads; ++i){
+        threads.emplace_back([&](){
+            while(!stop.load(memory_order_relaxed)){
+                int ok = burst_conns(saddr, BURST);
+                done.fetch_add(ok, memory_order_relaxed);
+                failed.fetch_add(BURST - ok, memory_order_relaxed);
+            }
+        });
+    }
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop.store(true);
+    for(auto& t : threads)
+        t.join();
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    if(failed.load())
+        cerr << failed.load() << " connections failed." << endl;
+    return (double)done.load() / seconds;
+}
+
+int main(int argc, char** argv){
+    int client_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+
+    //先跑完再输出：fork出的子进程会带着cout缓冲区，freopen时会把未输出的内容再写一遍
+    double single_one = run_mode(false, 1, client_threads, seconds);
+    double single_batch = run_mode(false, 64, client_threads, seconds);
+    double reuse_batch = run_mode(true, 64, client_threads, seconds);
+
+    cout << client_threads << " client threads x " << BURST << " conns per burst, " << seconds << "s each:" << endl;
+    cout << "single lfd, acceptBatch 1:  " << single_one << " conns/s" << endl;
+    cout << "single lfd, acceptBatch 64: " << single_batch << " conns/s" << endl;
+    cout << "reusePort,  acceptBatch 64: " << reuse_batch << " conns/s" << endl;
+
+    return 0;
+}
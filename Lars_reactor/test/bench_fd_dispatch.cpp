@@ -0,0 +1,109 @@
+#include "event_handler.h"
+#include <unordered_map>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <sys/epoll.h>
+using namespace std;
+
+//fd到event_handler的分发开销对比：unordered_map查找 vs fd下标数组 vs data.ptr直接指向handler
+//模拟event_process中的分发：取出handler，判断掩码，调用读回调。
+//10万个fd超过一般进程的ulimit，这里不创建真实fd，只对比两种表结构本身的开销。
+
+const int EVENTS = 10000000;     //每轮分发的事件数
+
+long g_sum = 0;
+void read_cb(event_loop* loop, int fd, void* args){
+    g_sum += fd;
+}
+
+//就绪fd随机分布，模拟大量链接中随机一部分活跃。和epoll_wait一样返回epoll_event数组
+vector<struct epoll_event> make_fired(int fd_cnt){
+    mt19937 gen(12345);
+    uniform_int_distribution<int> dist(0, fd_cnt - 1);
+    vector<struct epoll_event> fired(EVENTS);
+    for(auto& ev : fired){
+        ev.events = EPOLLIN;
+        ev.data.fd = dist(gen);
+    }
+    return fired;
+}
+
+double bench_map(int fd_cnt, const vector<struct epoll_event>& fired){
+    unordered_map<int, event_handler> table;
+    for(int fd = 0; fd < fd_cnt; ++fd){
+        table[fd].mask = 1;
+        table[fd].read_callback = read_cb;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for(auto& ev : fired){
+        int fd = ev.data.fd;
+        auto it = table.find(fd);
+        if(it == table.end())
+            continue;
+        event_handler* hdl = &(it->second);
+        if(hdl->mask)
+            hdl->read_callback(nullptr, fd, hdl->rcb_args);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / fired.size();
+}
+
+double bench_vector(int fd_cnt, const vector<struct epoll_event>& fired){
+    vector<event_handler> table(fd_cnt);
+    for(int fd = 0; fd < fd_cnt; ++fd){
+        table[fd].mask = 1;
+        table[fd].read_callback = read_cb;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for(auto& ev : fired){
+        int fd = ev.data.fd;
+        event_handler* hdl = &table[fd];
+        if(hdl->mask)
+            hdl->read_callback(nullptr, fd, hdl->rcb_args);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / fired.size();
+}
+
+double bench_ptr(int fd_cnt, vector<struct epoll_event> fired){
+    vector<event_handler> table(fd_cnt);
+    for(int fd = 0; fd < fd_cnt; ++fd){
+        table[fd].mask = 1;
+        table[fd].read_callback = read_cb;
+        table[fd].fd = fd;
+    }
+
+    //epoll_wait返回的事件中data.ptr已经是handler地址，这里提前准备好，不计入分发时间
+    for(auto& ev : fired)
+        ev.data.ptr = &table[ev.data.fd];
+
+    uint64_t batch = 1;
+    auto start = chrono::steady_clock::now();
+    for(auto& ev : fired){
+        event_handler* hdl = (event_handler*)ev.data.ptr;
+        if(hdl->del_batch != batch && hdl->mask)
+            hdl->read_callback(nullptr, hdl->fd, hdl->rcb_args);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / fired.size();
+}
+
+int main(){
+    for(int fd_cnt : {10000, 100000}){
+        vector<struct epoll_event> fired = make_fired(fd_cnt);
+
+        double map_ns = bench_map(fd_cnt, fired);
+        double vec_ns = bench_vector(fd_cnt, fired);
+        double ptr_ns = bench_ptr(fd_cnt, fired);
+
+        cout << fd_cnt << " fds: unordered_map " << map_ns << " ns/event, vector "
+             << vec_ns << " ns/event, data.ptr " << ptr_ns << " ns/event" << endl;
+    }
+    cout << "(checksum " << g_sum << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "reactor_buf.h"
+#include "message.h"
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+using namespace std;
+
+//接收路径对比：旧的连续input_buf(不够时换大块整体拷贝，消费后adjust搬移剩余数据)
+//vs 新的io_buf链(readv读进尾部和新块，只有跨块的消息才拼接拷贝)。
+//socketpair模拟链接，发送方把大消息切成CHUNK字节的小段发送，每段到达接收方就读一次并解析，
+//模拟大消息分多个TCP段到达。解析和tcp_conn::do_read一样，不完整的包先reserve。
+//统计每收到一字节拷贝了多少字节，以及每字节耗时。
+
+const int CHUNK = 1400;                     //每次到达的字节数，约一个MSS
+const long TOTAL = 256L * 1024 * 1024;      //每轮接收总字节数
+
+//旧实现：单块连续缓冲，copied统计grow和adjust拷贝的字节数
+class contig_input_buf{
+public:
+    contig_input_buf():copied(0), _buf(nullptr){}
+    ~contig_input_buf(){
+        if(_buf)    buf_pool::get_instance()->revert(_buf);
+    }
+    int length(){
+        return _buf ? _buf->length : 0;
+    }
+    void reserve(int len){}
+    const char* data(){
+        return _buf ? _buf->data + _buf->head : NULL;
+    }
+    void pop(int len){
+        _buf->pop(len);
+        if(_buf->length == 0){
+            buf_pool::get_instance()->revert(_buf);
+            _buf = nullptr;
+        }
+    }
+    void adjust(){
+        if(_buf && _buf->head != 0){
+            copied += _buf->length;
+            _buf->adjust();
+        }
+    }
+    int read_data(int fd){
+        int need_read = 0;
+        ioctl(fd, FIONREAD, &need_read);
+        if(!_buf){
+            _buf = buf_pool::get_instance()->alloc_buf(need_read);
+        }
+        else if(_buf->capacity - _buf->length < need_read){
+            io_buf* new_buf = buf_pool::get_instance()->alloc_buf(need_read + _buf->length);
+            new_buf->copy(_buf);
+            copied += _buf->length;
+            buf_pool::get_instance()->revert(_buf);
+            _buf = new_buf;
+        }
+        int ret = read(fd, _buf->data + _buf->length, need_read);
+        if(ret > 0)
+            _buf->length += ret;
+        return ret;
+    }
+
+    long copied;
+private:
+    io_buf* _buf;
+};
+
+//和tcp_conn::do_read一样解析消息，返回本次解析出的消息数
+long g_sum = 0;
+template<typename BUF, typename PEEK>
+int decode(BUF& ibuf, PEEK peek){
+    int msgs = 0;
+    while(ibuf.length() >= MESSAGE_HEAD_LEN){
+        msg_head head;
+        memcpy(&head, peek(MESSAGE_HEAD_LEN), MESSAGE_HEAD_LEN);
+        int msglen = ntohl(head.msglen);
+        if(ibuf.length() < MESSAGE_HEAD_LEN + msglen){
+            ibuf.reserve(MESSAGE_HEAD_LEN + msglen);
+            break;
+        }
+        ibuf.pop(MESSAGE_HEAD_LEN);
+        g_sum += peek(msglen)[msglen - 1];      //模拟业务访问消息体
+        ibuf.pop(msglen);
+        ++msgs;
+    }
+    return msgs;
+}
+
+//发送方写一段，接收方read_data+解析一次。返回每字节耗时(ns)
+template<typename READ, typename DECODE>
+double run(int frame_len, READ read_fd, DECODE decode_msgs){
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    //一个消息的完整字节流，按CHUNK切段发送
+    vector<char> frame(MESSAGE_HEAD_LEN + frame_len, 'x');
+    msg_head head{(int)htonl(1), (int)htonl(frame_len)};
+    memcpy(frame.data(), &head, MESSAGE_HEAD_LEN);
+
+    long sent = 0, msgs = 0;
+    int off = 0;
+    auto start = chrono::steady_clock::now();
+    while(sent < TOTAL){
+        int n = min(CHUNK, (int)frame.size() - off);
+        if(write(fds[0], frame.data() + off, n) != n)
+            cerr << "Write error." << endl;
+        off = (off + n) % frame.size();
+        sent += n;
+
+        read_fd(fds[1]);
+        msgs += decode_msgs();
+    }
+    auto end = chrono::steady_clock::now();
+
+    if(msgs != sent / (long)frame.size())
+        cerr << "Decode error: " << msgs << " msgs." << endl;
+    close(fds[0]);
+    close(fds[1]);
+    return chrono::duration<double, nano>(end - start).count() / sent;
+}
+
+int main(){
+    for(int frame_len : {512, 16 * 1024, MESSAGE_LENGTH_LIMIT}){
+        contig_input_buf contig;
+        double old_ns = run(frame_len, [&contig](int fd){ contig.read_data(fd); }, [&contig](){
+            int msgs = decode(contig, [&contig](int){ return contig.data(); });
+            contig.adjust();
+            return msgs;
+        });
+        double old_ratio = (double)contig.copied / TOTAL;
+
+        input_buf chain;
+        uint64_t read0, copied0, read1, copied1;
+        input_buf::get_copy_stats(read0, copied0);
+        double new_ns = run(frame_len, [&chain](int fd){ chain.read_data(fd); }, [&chain](){
+            return decode(chain, [&chain](int len){ return chain.peek(len); });
+        });
+        input_buf::get_copy_stats(read1, copied1);
+        double new_ratio = (double)(copied1 - copied0) / (read1 - read0);
+
+        cout << "frame " << frame_len << "B in " << CHUNK << "B chunks: contiguous " << old_ns << " ns/B, "
+             << old_ratio << " copied/B; chain+readv " << new_ns << " ns/B, " << new_ratio << " copied/B" << endl;
+    }
+    cout << "(checksum " << g_sum << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "message.h"
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+//消息分发开销对比：旧的两个unordered_map(find + 两次operator[] + std::function)
+//vs 新的msgid下标数组(一次查找，普通函数直接调用)。
+//每次分发调用一个累加计数的回调，msgid在已注册的几个之间轮换，模拟一个服务的几种请求。
+
+const int CALLS = 20000000;
+
+long g_sum = 0;
+
+void count_busi(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    g_sum += msgid + len;
+}
+
+//旧实现
+class map_router{
+public:
+    void register_msg_router(int msgid, msg_callback msg_cb, void* usr_data){
+        _msgid2router[msgid] = msg_cb;
+        _msgid2args[msgid] = usr_data;
+    }
+    void call(int msgid, uint32_t msglen, const char* data, net_connection* conn){
+        if(_msgid2router.find(msgid) == _msgid2router.end())
+            return;
+        auto callback = _msgid2router[msgid];
+        auto usr_data = _msgid2args[msgid];
+        callback(data, msglen, msgid, conn, usr_data);
+    }
+private:
+    unordered_map<int, msg_callback> _msgid2router;
+    unordered_map<int, void*> _msgid2args;
+};
+
+//ids中的msgid轮流分发，返回每次分发的纳秒数
+template<typename ROUTER>
+double bench(ROUTER& router, const int* ids, int id_cnt){
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < CALLS; ++i)
+        router.call(ids[i % id_cnt], 1, nullptr, nullptr);
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / CALLS;
+}
+
+int main(){
+    //lars.proto中的请求id都是1~10之间的小整数
+    const int dense_ids[] = {1, 2, 3, 4, 5, 6};
+    //稀疏id，走哈希表
+    const int sparse_ids[] = {100001, 200002, 300003, 400004, 500005, 600006};
+
+    map_router old_router;
+    msg_router fn_router;       //注册普通函数
+    msg_router func_router;     //注册lambda，走std::function
+    for(int k = 0; k < 6; ++k){
+        for(int id : {dense_ids[k], sparse_ids[k]}){
+            old_router.register_msg_router(id, count_busi, nullptr);
+            fn_router.register_msg_router(id, count_busi, nullptr);
+            func_router.register_msg_router(id, [](const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+                g_sum += msgid + len;
+            }, nullptr);
+        }
+    }
+
+    cout << "dense msgid:  two maps " << bench(old_router, dense_ids, 6) << " ns, array+fn-ptr "
+         << bench(fn_router, dense_ids, 6) << " ns, array+std::function " << bench(func_router, dense_ids, 6) << " ns" << endl;
+    cout << "sparse msgid: two maps " << bench(old_router, sparse_ids, 6) << " ns, hash+fn-ptr "
+         << bench(fn_router, sparse_ids, 6) << " ns, hash+std::function " << bench(func_router, sparse_ids, 6) << " ns" << endl;
+    cout << "(checksum " << g_sum << ")" << endl;
+
+    return 0;
+}
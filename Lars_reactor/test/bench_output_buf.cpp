@@ -0,0 +1,128 @@
+#include "reactor_buf.h"
+#include "message.h"
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+using namespace std;
+
+//发送路径对比：旧的连续output_buf(消息头、消息体各memcpy一次，不够时换大块整体拷贝，write)
+//vs 新的io_buf链(缓冲为空时writev直接发，只缓冲没写完的部分，不够时挂新块)。
+//socketpair模拟链接，每发BATCH个消息对端才读一次，模拟慢对端/大响应(如GetRouteResponse)时的积压。
+
+const int MSGS = 200000;
+const int BATCH = 16;
+
+//旧实现：单块连续缓冲
+class contig_output_buf{
+public:
+    contig_output_buf():_buf(nullptr){}
+    ~contig_output_buf(){
+        if(_buf)    buf_pool::get_instance()->revert(_buf);
+    }
+    int length(){
+        return _buf ? _buf->length : 0;
+    }
+    int write2buf(const char* data, int datalen){
+        if(!_buf){
+            _buf = buf_pool::get_instance()->alloc_buf(datalen);
+        }
+        else if(_buf->capacity - _buf->length < datalen){
+            io_buf* new_buf = buf_pool::get_instance()->alloc_buf(datalen + _buf->length);
+            new_buf->copy(_buf);
+            buf_pool::get_instance()->revert(_buf);
+            _buf = new_buf;
+        }
+        memcpy(_buf->data + _buf->length, data, datalen);
+        _buf->length += datalen;
+        return 0;
+    }
+    int write2fd(int fd){
+        while(_buf && _buf->length > 0){
+            int ret = write(fd, _buf->data + _buf->head, _buf->length);
+            if(ret > 0)
+                _buf->pop(ret);
+            else
+                break;
+        }
+        if(_buf){
+            if(_buf->length == 0){
+                buf_pool::get_instance()->revert(_buf);
+                _buf = nullptr;
+            }
+            else{
+                _buf->adjust();
+            }
+        }
+        return 0;
+    }
+private:
+    io_buf* _buf;
+};
+
+//对端读空
+void drain(int fd){
+    static char sink[65536];
+    while(read(fd, sink, sizeof(sink)) > 0);
+}
+
+//SEND发送一个消息，FLUSH把缓冲中剩余数据写给fd并返回剩余长度
+template<typename SEND, typename FLUSH>
+double run(int body_len, SEND send_msg, FLUSH flush){
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    vector<char> body(body_len, 'x');
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < MSGS; ++i){
+        send_msg(fds[0], body.data(), body_len);
+        //对端读一次，发送方把积压的数据全部写完，积压不会无限增长
+        if(i % BATCH == BATCH - 1){
+            do{
+                drain(fds[1]);
+            }while(flush(fds[0]) > 0);
+        }
+    }
+    auto end = chrono::steady_clock::now();
+
+    close(fds[0]);
+    close(fds[1]);
+    return chrono::duration<double, nano>(end - start).count() / MSGS;
+}
+
+int main(){
+    for(int body_len : {256, 4096, 32768}){
+        contig_output_buf contig;
+        double old_ns = run(body_len, [&contig](int fd, const char* data, int len){
+            msg_head head{(int)htonl(1), (int)htonl(len)};
+            contig.write2buf((const char*)&head, MESSAGE_HEAD_LEN);
+            contig.write2buf(data, len);
+            contig.write2fd(fd);
+        }, [&contig](int fd){
+            contig.write2fd(fd);
+            return contig.length();
+        });
+
+        output_buf chain;
+        double new_ns = run(body_len, [&chain](int fd, const char* data, int len){
+            msg_head head{(int)htonl(1), (int)htonl(len)};
+            struct iovec iov[2] = {{&head, MESSAGE_HEAD_LEN}, {(void*)data, (size_t)len}};
+            chain.send_iov(fd, iov, 2);
+            chain.write2fd(fd);
+        }, [&chain](int fd){
+            chain.write2fd(fd);
+            return chain.length();
+        });
+
+        cout << "body " << body_len << "B: contiguous+write " << old_ns << " ns/msg, chain+writev " << new_ns << " ns/msg" << endl;
+    }
+
+    return 0;
+}
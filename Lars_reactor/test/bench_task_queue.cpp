@@ -0,0 +1,100 @@
+#include "event_loop.h"
+#include <unordered_map>
+#include <utility>
+#include <array>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+//异步任务队列开销对比：旧的unordered_map<task_callback, void*> vs 新的FIFO vector
+//每轮投递BATCH个任务再全部执行，模拟一次循环中的execute_ready_tasks。
+//旧实现同一回调会被覆盖，为了公平这里每轮用BATCH个不同的回调。
+
+const int BATCH = 16;           //每轮投递的任务数
+const int ROUNDS = 1000000;     //轮数
+
+long g_sum = 0;
+
+template<int I>
+void task_cb(event_loop* loop, void* args){
+    g_sum += I + (long)args;
+}
+
+//BATCH个不同的回调函数
+template<size_t... I>
+constexpr array<task_callback, sizeof...(I)> make_cbs(index_sequence<I...>){
+    return {task_cb<I>...};
+}
+const auto g_cbs = make_cbs(make_index_sequence<BATCH>());
+
+double bench_map(){
+    unordered_map<task_callback, void*> tasks;
+    auto start = chrono::steady_clock::now();
+    for(int r = 0; r < ROUNDS; ++r){
+        for(int i = 0; i < BATCH; ++i)
+            tasks[g_cbs[i]] = (void*)(long)r;
+        for(auto it : tasks)
+            it.first(nullptr, it.second);
+        tasks.clear();
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / ROUNDS / BATCH;
+}
+
+double bench_fn_ptr(event_loop& loop){
+    auto start = chrono::steady_clock::now();
+    for(int r = 0; r < ROUNDS; ++r){
+        for(int i = 0; i < BATCH; ++i)
+            loop.add_task(g_cbs[i], (void*)(long)r);
+        loop.execute_ready_tasks();
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / ROUNDS / BATCH;
+}
+
+double bench_func(event_loop& loop){
+    auto start = chrono::steady_clock::now();
+    for(int r = 0; r < ROUNDS; ++r){
+        for(int i = 0; i < BATCH; ++i){
+            long arg = r;
+            task_callback cb = g_cbs[i];
+            //捕获两个指针大小的数据，在std::function内部存放
+            loop.add_task([cb, arg](event_loop* loop){ cb(loop, (void*)arg); });
+        }
+        loop.execute_ready_tasks();
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / ROUNDS / BATCH;
+}
+
+//顺序与重复投递检查
+vector<int> g_order;
+void order_cb(event_loop* loop, void* args){
+    g_order.push_back((int)(long)args);
+}
+
+int main(){
+    event_loop loop;
+
+    for(int i = 0; i < 5; ++i)
+        loop.add_task(order_cb, (void*)(long)i);
+    loop.add_task([](event_loop* loop){ g_order.push_back(5); });
+    loop.add_task(order_cb, (void*)6L);
+    loop.execute_ready_tasks();
+    for(int i = 0; i < 7; ++i){
+        if((int)g_order.size() != 7 || g_order[i] != i){
+            cerr << "Task order error." << endl;
+            return 1;
+        }
+    }
+    cout << "7 tasks (same callback posted 6 times) executed in FIFO order." << endl;
+
+    double map_ns = bench_map();
+    double ptr_ns = bench_fn_ptr(loop);
+    double func_ns = bench_func(loop);
+    cout << "per task: unordered_map " << map_ns << " ns, vector fn-ptr " << ptr_ns
+         << " ns, vector std::function " << func_ns << " ns" << endl;
+    cout << "(checksum " << g_sum << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "thread_queue.hpp"
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+//thread_queue多生产者吞吐对比：无锁MPSC+合并通知 vs 旧实现(mutex+std::queue，每次send都写evfd)
+//每轮起一个工作线程loop消费，1/2/4/8个生产者线程并发send，统计吞吐和消费端被唤醒次数。
+
+const int TASKS = 2000000;      //每轮任务总数，平均分给生产者
+
+//旧实现，作为对比基准
+template<typename T>
+class mutex_queue{
+public:
+    mutex_queue():_loop(nullptr){
+        _evfd = eventfd(0, EFD_NONBLOCK);
+    }
+    ~mutex_queue(){
+        close(_evfd);
+    }
+    void send(const T& task){
+        lock_guard<mutex> lock(_mutex);
+        _queue.push(task);
+        uint64_t evfd_sig = 1;
+        if(write(_evfd, &evfd_sig, sizeof(evfd_sig)) == -1)
+            cerr << "Evfd write error."<< endl;
+    }
+    void recv(queue<T>& queue_copy){
+        lock_guard<mutex> lock(_mutex);
+        uint64_t evfd_sig = 0;
+        if(read(_evfd, &evfd_sig, sizeof(evfd_sig)) == -1)
+            return;
+        swap(queue_copy, _queue);
+    }
+    void set_loop(event_loop* loop){
+        _loop = loop;
+    }
+    void set_callback(io_callback* cb, void* args = NULL){
+        _loop->add_io_event(_evfd, cb, EPOLLIN, args);
+    }
+private:
+    int _evfd;
+    event_loop* _loop;
+    queue<T> _queue;
+    mutex _mutex;
+};
+
+//每轮的消费统计，只有loop线程写
+struct round_stat{
+    long received;
+    long wakeups;
+    long sum;
+    chrono::steady_clock::time_point end;
+    atomic<bool> done;
+};
+
+template<typename Q>
+void consume(event_loop* loop, int fd, void* args){
+    auto ctx = (pair<Q*, round_stat*>*)args;
+    round_stat* stat = ctx->second;
+
+    queue<long> tasks;
+    ctx->first->recv(tasks);
+    ++stat->wakeups;
+    stat->received += tasks.size();
+    while(!tasks.empty()){
+        stat->sum += tasks.front();
+        tasks.pop();
+    }
+
+    if(stat->received == TASKS && !stat->done){
+        stat->end = chrono::steady_clock::now();
+        stat->done.store(true);
+    }
+}
+
+//跑一轮，返回每秒任务数(百万)。工作线程loop没有退出接口，一轮结束后空闲阻塞在epoll_wait上
+template<typename Q>
+double run_round(int producers, long& wakeups){
+    Q* q = new Q();
+    event_loop* loop = new event_loop();
+    round_stat* stat = new round_stat{0, 0, 0, {}, {false}};
+    auto ctx = new pair<Q*, round_stat*>(q, stat);
+
+    q->set_loop(loop);
+    q->set_callback(consume<Q>, ctx);
+    thread(&event_loop::event_process, loop).detach();
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for(int p = 0; p < producers; ++p){
+        threads.emplace_back([q, producers](){
+            for(int i = 0; i < TASKS / producers; ++i)
+                q->send(1);
+        });
+    }
+    for(auto& t : threads)
+        t.join();
+    while(!stat->done.load())
+        this_thread::sleep_for(chrono::milliseconds(1));
+
+    if(stat->sum != TASKS)
+        cerr << "Lost tasks: " << TASKS - stat->sum << endl;
+    wakeups = stat->wakeups;
+    return TASKS / chrono::duration<double, micro>(stat->end - start).count();
+}
+
+int main(){
+    for(int producers : {1, 2, 4, 8}){
+        long lf_wakeups, mtx_wakeups;
+        double lf = run_round<thread_queue<long>>(producers, lf_wakeups);
+        double mtx = run_round<mutex_queue<long>>(producers, mtx_wakeups);
+
+        cout << producers << " producers: lock-free " << lf << " M tasks/s (" << lf_wakeups
+             << " wakeups), mutex " << mtx << " M tasks/s (" << mtx_wakeups << " wakeups)" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "test_util.h"
+#include <vector>
+#include <atomic>
+#include <string>
+#include <poll.h>
+using namespace std;
+
+//攒写模式对比：每个请求服务器回REPLIES个小消息(如一次查询返回多条路由)，客户端每次发PIPELINE个请求。
+//不攒写时每个conn_write2fd一次writev；攒写时同一轮回调里的全部回复在本轮末尾一次writev。
+//统计每秒回复数，和服务器每条回复用了几次写系统调用(/proc/self/io的syscw减去客户端自己的写)。
+
+const char* IP = "127.0.0.1";
+const int PORT = 7793;
+const char* CONF = "/tmp/bench_write_cork.ini";
+const int CONNS = 4;
+const int PIPELINE = 16;        //每次发送的请求数
+const int REPLIES = 8;          //每个请求的回复数
+const int REPLY_LEN = 64;       //回复消息体长度
+const int SECS = 2;
+
+void multi_reply(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    char reply[REPLY_LEN] = {0};
+    for(int i = 0; i < REPLIES; ++i)
+        conn->conn_write2fd(reply, REPLY_LEN, 2);
+}
+
+//本进程write/writev系统调用总次数
+long write_syscalls(){
+    ifstream io("/proc/self/io");
+    string line;
+    while(getline(io, line)){
+        if(line.compare(0, 6, "syscw:") == 0)
+            return atol(line.c_str() + 6);
+    }
+    return -1;
+}
+
+//给服务器工作线程设置攒写模式，等它生效
+void set_cork(event_loop* loop, bool on){
+    atomic<bool> done(false);
+    loop->run_in_loop([on, &done](event_loop* l){
+        l->set_write_cork(on);
+        done = true;
+    });
+    while(!done)
+        this_thread::sleep_for(chrono::milliseconds(1));
+}
+
+//压测SECS秒，返回每秒回复数，client_writes传出客户端自己的写次数
+double run(const vector<int>& fds, long& replies, long& client_writes){
+    vector<char> batch;
+    msg_head head{(int)htonl(1), (int)htonl(0)};
+    for(int i = 0; i < PIPELINE; ++i)
+        batch.insert(batch.end(), (char*)&head, (char*)&head + MESSAGE_HEAD_LEN);
+    const long batch_reply_bytes = (long)PIPELINE * REPLIES * (MESSAGE_HEAD_LEN + REPLY_LEN);
+
+    vector<long> pending(fds.size(), 0);    //每个链接还没收完的回复字节
+    replies = client_writes = 0;
+    long recvd = 0;
+    auto start = chrono::steady_clock::now();
+    auto end = start + chrono::seconds(SECS);
+    while(chrono::steady_clock::now() < end){
+        for(size_t i = 0; i < fds.size(); ++i){
+            if(pending[i] == 0){
+                if(write(fds[i], batch.data(), batch.size()) != (int)batch.size())
+                    cerr << "Write error." << endl;
+                ++client_writes;
+                pending[i] = batch_reply_bytes;
+            }
+        }
+
+        vector<struct pollfd> pfds;
+        for(int fd : fds)
+            pfds.push_back({fd, POLLIN, 0});
+        poll(pfds.data(), pfds.size(), 100);
+        for(size_t i = 0; i < fds.size(); ++i){
+            if(!(pfds[i].revents & POLLIN))
+                continue;
+            char sink[65536];
+            int ret = read(fds[i], sink, sizeof(sink));
+            if(ret > 0){
+                pending[i] -= ret;
+                recvd += ret;
+            }
+        }
+    }
+
+    //收完在途的回复
+    for(size_t i = 0; i < fds.size(); ++i){
+        while(pending[i] > 0){
+            char sink[65536];
+            int ret = read(fds[i], sink, min<long>(sizeof(sink), pending[i]));
+            if(ret <= 0)
+                break;
+            pending[i] -= ret;
+            recvd += ret;
+        }
+    }
+    replies = recvd / (MESSAGE_HEAD_LEN + REPLY_LEN);
+    return replies / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 64\nthreadNums = 1\n");
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+
+    event_loop* loop;
+    tcp_server* server = new_server(IP, PORT, &loop);
+    server->add_msg_router(1, multi_reply);
+    run_loop(loop);
+    event_loop* worker = server->get_thread_pool()->get_loop(0);
+
+    vector<int> fds;
+    for(int i = 0; i < CONNS; ++i)
+        fds.push_back(connect_server(IP, PORT));
+    cout.rdbuf(cout_buf);
+    cout << CONNS << " conns, " << PIPELINE << " pipelined requests, " << REPLIES << " x " << REPLY_LEN
+         << "B replies per request" << endl;
+
+    for(bool cork : {false, true}){
+        set_cork(worker, cork);
+        loop_stats st0, st1;
+        worker->get_stats(st0);
+        long sys0 = write_syscalls();
+
+        long replies, client_writes;
+        double rps = run(fds, replies, client_writes);
+
+        long server_writes = write_syscalls() - sys0 - client_writes;
+        worker->get_stats(st1);
+        cout << (cork ? "writeCork on : " : "writeCork off: ") << rps << " replies/s, "
+             << (double)server_writes / replies << " write syscalls/reply";
+        if(cork)
+            cout << ", " << st1.flushes - st0.flushes << " flushes, " << st1.flush_blocked - st0.flush_blocked << " hit EAGAIN";
+        cout << endl;
+    }
+
+    cout.rdbuf(nullptr);
+    for(int fd : fds)
+        close(fd);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/bash
+# LT与ET模式的qps对比。
+# 用法: ./lt_et_compare.sh [client_thread_num] [seconds]
+# 需先编译qps_server_tcp、qps_client_tcp。服务端和客户端使用相同的触发模式。
+
+THREADS=${1:-4}
+SECONDS_PER_MODE=${2:-10}
+CONF=../../conf/server.ini
+
+for MODE in lt et; do
+    TMP_CONF=$(mktemp /tmp/qps_${MODE}_XXXX.ini)
+    if [ "$MODE" = "et" ]; then ET=true; else ET=false; fi
+    sed "s/^edgeTrigger.*/edgeTrigger = $ET/" $CONF > $TMP_CONF
+    grep -q "^edgeTrigger" $TMP_CONF || echo "edgeTrigger = $ET" >> $TMP_CONF
+
+    ./qps_server_tcp $TMP_CONF > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+
+    timeout $SECONDS_PER_MODE ./qps_client_tcp $THREADS $MODE > /tmp/qps_${MODE}.log 2>&1
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+    rm -f $TMP_CONF
+
+    #去掉第一秒(连接建立)，统计每个客户端线程的平均qps之和
+    echo "$MODE: $(grep 'QPS =' /tmp/qps_${MODE}.log | awk -v t=$THREADS 'NR>t {sum+=$3; n++} END {if(n) printf "avg total QPS = %d\n", sum/n*t}')"
+done
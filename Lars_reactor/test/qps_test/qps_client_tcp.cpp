@@ -71,6 +71,10 @@ void on_client_build(net_connection* conn, void* args){
 void* thread_main(void* args){
     event_loop loop;
 
+    //是否使用ET模式，需在client注册fd之前设置
+    bool edge_trigger = *(bool*)args;
+    loop.set_edge_trigger(edge_trigger);
+
     tcp_client client(&loop, "127.0.0.1", 7777);
 
     //创建qps句柄
@@ -89,15 +93,18 @@ void* thread_main(void* args){
 
 int main(int argc, char** argv){
     if(argc == 1){
-        cout << "Usage: ./qps_client_tcp [thread_num]" << endl;
+        cout << "Usage: ./qps_client_tcp [thread_num] [lt|et]" << endl;
         exit(1);
     }
 
     int thread_num = atoi(argv[1]);
     vector<pthread_t> tids(thread_num);
 
+    //第二个参数选择触发模式，默认LT
+    static bool edge_trigger = (argc > 2 && strcmp(argv[2], "et") == 0);
+
     for(int i = 0; i < thread_num; ++i){
-        pthread_create(&tids[i], NULL, thread_main, NULL);
+        pthread_create(&tids[i], NULL, thread_main, &edge_trigger);
     }
 
     for(int i = 0; i < thread_num; ++i)
@@ -25,10 +25,11 @@ void callback_busi(const char* data, uint32_t len, int msgid, net_connection* co
     conn->conn_write2fd(response_string.c_str(), response_string.size(), msgid);
 }
 
-int main(){
+int main(int argc, char** argv){
     event_loop loop;
 
-    config_file::setPath("../../conf/server.ini");
+    //可以指定配置文件，便于对比不同配置(如LT/ET)
+    config_file::setPath(argc > 1 ? argv[1] : "../../conf/server.ini");
     string ip = config_file::instance()->GetString("reactor", "ip", "0.0.0.0");
     uint16_t port = config_file::instance()->GetNumber("reactor", "port", 8888);
 
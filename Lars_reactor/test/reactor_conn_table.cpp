@@ -0,0 +1,105 @@
+#include "test_util.h"
+#include <vector>
+#include <mutex>
+using namespace std;
+
+//链接表测试：
+//1. 先打开200个fd占位，链接的fd号远大于maxConns，旧的定长conns数组会越界
+//2. 主线程拿着链接句柄跨线程send_to_conn，消息送到对应链接
+//3. 链接关闭后fd被同一loop的新链接复用，代数加一，旧句柄发的消息被丢弃，不会送到新链接
+
+const char* IP = "127.0.0.1";
+const int PORT = 7792;
+const char* CONF = "/tmp/reactor_conn_table.ini";
+
+//conn_start Hook在工作线程记录最新链接的句柄
+mutex g_mutex;
+event_loop* g_loop = nullptr;
+conn_id g_id = 0;
+
+void on_conn_start(net_connection* conn, void* args){
+    tcp_conn* tconn = (tcp_conn*)conn;
+    lock_guard<mutex> lock(g_mutex);
+    g_loop = tconn->get_loop();
+    g_id = tconn->get_conn_id();
+}
+
+//连上服务器，等Hook记录下句柄
+int connect_and_wait(conn_id& id, event_loop*& loop){
+    {
+        lock_guard<mutex> lock(g_mutex);
+        g_id = 0;
+    }
+
+    int fd = connect_server(IP, PORT);
+
+    while(1){
+        {
+            lock_guard<mutex> lock(g_mutex);
+            if(g_id != 0){
+                id = g_id;
+                loop = g_loop;
+                return fd;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 4\nthreadNums = 1\n");
+
+    //1. 占用200个fd
+    vector<int> fillers;
+    for(int i = 0; i < 200; ++i)
+        fillers.push_back(open("/dev/null", O_RDONLY));
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+
+    event_loop* loop;
+    tcp_server* server = new_server(IP, PORT, &loop);
+    server->set_conn_start(on_conn_start);
+    run_loop(loop);
+
+    bool ok = true;
+
+    //2. 跨线程发消息
+    conn_id old_id;
+    event_loop* old_loop;
+    int fd1 = connect_and_wait(old_id, old_loop);
+    old_loop->send_to_conn(old_id, "hello", 5, 1);
+    string msg = read_msg(fd1, 1000);
+    if(msg != "hello")
+        ok = false;
+    cout.rdbuf(cout_buf);
+    cout << "server fd " << (int)(uint32_t)old_id << " (maxConns 4), send_to_conn from main thread: "
+         << (msg == "hello" ? "received" : "LOST") << endl;
+    cout.rdbuf(nullptr);
+
+    //3. 关闭后重连，服务器端fd被复用
+    close(fd1);
+    this_thread::sleep_for(chrono::milliseconds(100));
+    conn_id new_id;
+    event_loop* new_loop;
+    int fd2 = connect_and_wait(new_id, new_loop);
+
+    old_loop->send_to_conn(old_id, "stale", 5, 1);
+    new_loop->send_to_conn(new_id, "fresh", 5, 1);
+    msg = read_msg(fd2, 1000);
+    //单工作线程，新链接拿到的一定是刚释放的最小fd，代数必须加一
+    bool reused = (uint32_t)old_id == (uint32_t)new_id;
+    if(msg != "fresh" || !reused || (new_id >> 32) != (old_id >> 32) + 1)
+        ok = false;
+
+    cout.rdbuf(cout_buf);
+    cout << "reconnect: server fd " << (reused ? "reused" : "not reused") << ", generation "
+         << (old_id >> 32) << " -> " << (new_id >> 32) << ", new conn got \"" << msg << "\""
+         << (msg == "fresh" ? " (stale handle dropped)" : " (WRONG)") << endl;
+
+    cout.rdbuf(nullptr);
+    close(fd2);
+    for(int fd : fillers)
+        close(fd);
+    return ok ? 0 : 1;
+}
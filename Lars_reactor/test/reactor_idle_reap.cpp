@@ -0,0 +1,94 @@
+#include "test_util.h"
+#include "tcp_client.h"
+#include <atomic>
+#include <poll.h>
+using namespace std;
+
+//空闲回收和心跳测试：服务器空闲超时2秒，心跳消息id 99。三个客户端：
+//A 连上后什么都不做(模拟被NAT丢掉的对端)，应在超时后被服务器关闭；
+//B 裸socket，收到心跳就回一个；C tcp_client设置了心跳id，自动回心跳。B、C过了超时时间仍应在线。
+
+const char* IP = "127.0.0.1";
+const int PORT = 7795;
+const char* CONF = "/tmp/reactor_idle_reap.ini";
+const int HEARTBEAT = 99;
+const int RUN_SECS = 5;
+
+atomic<int> g_client_closed(0);
+
+void on_client_close(net_connection* conn, void* args){
+    ++g_client_closed;
+}
+
+//客户端B：收到心跳就回，返回收到的心跳数，链接被关闭返回-1
+int answer_heartbeats(int fd, int secs){
+    int beats = 0;
+    auto end = chrono::steady_clock::now() + chrono::seconds(secs);
+    while(chrono::steady_clock::now() < end){
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        msg_head head;
+        if(read(fd, &head, MESSAGE_HEAD_LEN) != MESSAGE_HEAD_LEN)
+            return -1;
+        if(ntohl(head.msgid) == HEARTBEAT && ntohl(head.msglen) == 0){
+            ++beats;
+            if(write(fd, &head, MESSAGE_HEAD_LEN) != MESSAGE_HEAD_LEN)
+                return -1;
+        }
+    }
+    return beats;
+}
+
+//链接是否已被对端关闭
+bool peer_closed(int fd){
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if(poll(&pfd, 1, 0) <= 0)
+        return false;
+    char buf[256];
+    int ret;
+    //先读掉可能收到的心跳
+    while((ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0);
+    return ret == 0;
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 16\nthreadNums = 1\nidleTimeout = 2\nheartbeatMsgid = " + to_string(HEARTBEAT) + "\n");
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+    streambuf* cerr_buf = cerr.rdbuf(nullptr);
+
+    event_loop* loop;
+    new_server(IP, PORT, &loop);
+    run_loop(loop);
+
+    //客户端C在自己的loop线程，和进程同生命周期
+    event_loop* cli_loop = new event_loop();
+    tcp_client* client = new tcp_client(cli_loop, IP, PORT);
+    client->set_heartbeat(HEARTBEAT);
+    client->set_conn_close(on_client_close);
+    run_loop(cli_loop);
+
+    int fd_a = connect_server(IP, PORT);
+    int fd_b = connect_server(IP, PORT);
+    auto start = chrono::steady_clock::now();
+    int beats = answer_heartbeats(fd_b, RUN_SECS);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    bool a_closed = peer_closed(fd_a);
+    int cur_conns;
+    tcp_server::get_conn_num(cur_conns);
+
+    cout.rdbuf(cout_buf);
+    cerr.rdbuf(cerr_buf);
+    cout << "after " << secs << "s (idle timeout 2s): silent conn " << (a_closed ? "reaped" : "STILL OPEN")
+         << ", heartbeat conn answered " << beats << " beats and " << (beats > 0 ? "stayed" : "WAS CLOSED")
+         << ", tcp_client " << (g_client_closed == 0 ? "stayed" : "WAS CLOSED") << ", server conns " << cur_conns << endl;
+    cout.rdbuf(nullptr);
+    cerr.rdbuf(nullptr);
+
+    close(fd_a);
+    close(fd_b);
+    return a_closed && beats > 0 && g_client_closed == 0 && cur_conns == 2 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "test_util.h"
+#include <vector>
+#include <poll.h>
+using namespace std;
+
+//内存背压测试：回显服务器，客户端只发不收，服务器的输出缓冲越积越多。
+//内存池软上限4MB、硬上限16MB：超过软上限后服务器暂停读，客户端很快写不动(TCP窗口)，内存停在软上限附近，
+//进程不退出、不断链。之后客户端开始收，服务器内存回落后恢复读，检查发出的每个字节都被完整回显。
+
+const char* IP = "127.0.0.1";
+const int PORT = 7791;
+const char* CONF = "/tmp/reactor_mem_limit.ini";
+const int CONNS = 8;
+const int FRAME = 60000;        //每个消息体长度
+
+void echo_busi(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    conn->conn_write2fd(data, len, msgid);
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 64\nthreadNums = 2\nbufPoolSoftLimit = 4\nbufPoolHardLimit = 16\n");
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+
+    event_loop* loop;
+    tcp_server* server = new_server(IP, PORT, &loop);
+    server->add_msg_router(1, echo_busi);
+    run_loop(loop);
+
+    //一个消息的完整字节流
+    vector<char> frame(MESSAGE_HEAD_LEN + FRAME, 'x');
+    msg_head head{(int)htonl(1), (int)htonl(FRAME)};
+    memcpy(frame.data(), &head, MESSAGE_HEAD_LEN);
+
+    vector<int> fds;
+    for(int i = 0; i < CONNS; ++i){
+        int fd = connect_server(IP, PORT);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fds.push_back(fd);
+    }
+
+    //1. 只发不收2秒
+    vector<long> sent(CONNS, 0), recvd(CONNS, 0);
+    vector<int> off(CONNS, 0);
+    buf_mem_stat stat;
+    uint64_t peak_kb = 0;
+    auto end = chrono::steady_clock::now() + chrono::seconds(2);
+    while(chrono::steady_clock::now() < end){
+        for(int i = 0; i < CONNS; ++i){
+            int ret = write(fds[i], frame.data() + off[i], frame.size() - off[i]);
+            if(ret > 0){
+                sent[i] += ret;
+                off[i] = (off[i] + ret) % frame.size();
+            }
+        }
+        buf_pool::get_instance()->get_mem_stats(stat);
+        peak_kb = max(peak_kb, stat.used_kb);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    long total_sent = 0;
+    for(long s : sent)
+        total_sent += s;
+    cout.rdbuf(cout_buf);
+    cout << "send-only phase: " << total_sent / 1024 << " kB sent on " << CONNS << " conns, server pool used peak "
+         << peak_kb << " kB (soft limit " << stat.soft_limit_kb << " kB, hard limit " << stat.hard_limit_kb << " kB)" << endl;
+    cout.rdbuf(nullptr);
+
+    //2. 所有链接一起收，同时把写到一半的消息补完，直到发出的都收回来。
+    //服务器内存被所有链接的输出缓冲共同占着，只收一个链接会一直等不到服务器恢复读
+    bool ok = false;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(20);
+    while(!ok && chrono::steady_clock::now() < deadline){
+        vector<struct pollfd> pfds;
+        for(int i = 0; i < CONNS; ++i)
+            pfds.push_back({fds[i], (short)(POLLIN | (off[i] ? POLLOUT : 0)), 0});
+        poll(pfds.data(), CONNS, 100);
+
+        ok = true;
+        for(int i = 0; i < CONNS; ++i){
+            if(off[i] != 0){
+                int ret = write(fds[i], frame.data() + off[i], frame.size() - off[i]);
+                if(ret > 0){
+                    sent[i] += ret;
+                    off[i] = (off[i] + ret) % frame.size();
+                }
+            }
+            char sink[65536];
+            int ret = read(fds[i], sink, sizeof(sink));
+            if(ret > 0)
+                recvd[i] += ret;
+            if(off[i] != 0 || recvd[i] != sent[i])
+                ok = false;
+        }
+    }
+    for(int fd : fds)
+        close(fd);
+
+    buf_pool::get_instance()->get_mem_stats(stat);
+    cout.rdbuf(cout_buf);
+    cout << "echo phase: " << (ok ? "all bytes echoed back" : "ECHO MISMATCH") << ", alloc fails " << stat.alloc_fails << endl;
+    cout.rdbuf(nullptr);
+
+    //用量要停在软上限附近：暂停读挡住了客户端，没有一直涨到硬上限
+    ok = ok && peak_kb < stat.hard_limit_kb;
+    return ok ? 0 : 1;
+}
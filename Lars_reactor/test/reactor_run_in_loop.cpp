@@ -0,0 +1,62 @@
+#include "event_loop.h"
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+//跨线程投递测试：多个线程向同一个工作loop run_in_loop，检查
+//1. 任务都在loop线程执行  2. 同一投递线程的任务保持顺序  3. 一个不丢
+
+const int PRODUCERS = 4;
+const int TASKS = 200000;       //每个投递线程的任务数
+
+//以下只在loop线程访问，不加锁
+long g_done = 0;
+int g_last[PRODUCERS];
+bool g_error = false;
+chrono::steady_clock::time_point g_start;
+
+void on_task(event_loop* loop, int producer, int seq){
+    if(!loop->is_in_loop_thread() || seq != g_last[producer] + 1)
+        g_error = true;
+    g_last[producer] = seq;
+
+    if(++g_done == (long)PRODUCERS * TASKS){
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - g_start).count();
+        cout << g_done << " tasks from " << PRODUCERS << " threads done, "
+             << g_done / us << " M tasks/s, " << (g_error ? "ORDER/THREAD ERROR" : "in order, all on loop thread") << endl;
+        exit(g_error ? 1 : 0);
+    }
+}
+
+int main(){
+    event_loop loop;
+    for(int& last : g_last)
+        last = -1;
+
+    //loop还没启动时投递的任务也要排队，由随后启动的loop线程执行，不能在投递线程上执行
+    loop.run_in_loop([](event_loop* loop){
+        if(!loop->is_in_loop_thread()){
+            cout << "task posted before event_process ran off the loop thread" << endl;
+            exit(1);
+        }
+    });
+
+    thread worker(&event_loop::event_process, &loop);
+
+    //工作线程启动的同时投递，不等它接管loop
+    g_start = chrono::steady_clock::now();
+    vector<thread> producers;
+    for(int p = 0; p < PRODUCERS; ++p){
+        producers.emplace_back([&loop, p](){
+            for(int i = 0; i < TASKS; ++i)
+                loop.run_in_loop([p, i](event_loop* loop){ on_task(loop, p, i); });
+        });
+    }
+    for(auto& t : producers)
+        t.join();
+
+    worker.join();
+    return 0;
+}
@@ -11,11 +11,11 @@ unique_ptr<tcp_server> server;
 void print_task(event_loop* loop, void*args){
     cout << "==========Active task callback============" << endl;
 
-    listen_fds fds; //传出参数
-    loop->get_listen_fds(fds);//从当前线程loop中获取，每个线程监听fd是不同的
+    vector<conn_id> ids; //传出参数
+    loop->get_conn_ids(ids);//从当前线程loop的链接表中获取，每个线程的链接是不同的
 
-    for(auto fd : fds){
-        tcp_conn* conn = tcp_server::conns[fd];     //链接池中取出该链接
+    for(auto id : ids){
+        net_connection* conn = loop->get_conn(id);
 
         if(conn){
             int msgid = 404;
@@ -35,8 +35,20 @@ void print_busi(const char* data, uint32_t len, int msgid, net_connection* conn,
     cout << "Receive from client: " << data << " ,msgid = "<< msgid << " ,len = " << len << endl;
 }
 
+//打印每个工作线程当前的链接数，观察分配策略(server.ini中dispatch)
+void print_conn_counts(){
+    vector<int> counts;
+    server->get_thread_pool()->get_conn_counts(counts);
+
+    cout << "Conns per thread:";
+    for(int cnt : counts)
+        cout << " " << cnt;
+    cout << endl;
+}
+
 void on_client_build(net_connection* conn, void* args){
     cout << "===>On_client_build is called!" << endl;
+    print_conn_counts();
     int msgid = 200;
     const char* msg = "Welcome. You are online!";
     conn->conn_write2fd(msg, strlen(msg), msgid);
@@ -51,6 +63,7 @@ void on_client_build(net_connection* conn, void* args){
 void on_client_lost(net_connection* conn, void* args){
     cout << "===>On_client_lost is called!" << endl;
     cout << "A Connection is lost." << endl;
+    print_conn_counts();
 }
 
 int main(){
@@ -0,0 +1,65 @@
+#include "event_loop.h"
+#include <iostream>
+using namespace std;
+
+//定时器测试：一次性、重复、取消，以及精度
+
+uint64_t start_ms;
+int every_id;
+int every_cnt = 0;
+long last_after = 0;        //上一个触发的一次性定时器的延迟，检查触发顺序
+bool failed = false;
+
+void on_after(event_loop* loop, void* args){
+    long delay = (long)args;
+    uint64_t elapsed = event_loop::now_ms() - start_ms;
+    cout << "run_after " << delay << "ms fired at +" << elapsed << "ms" << endl;
+
+    //不能提前触发，按到期时间先后触发
+    if(elapsed < (uint64_t)delay || delay < last_after){
+        cout << "Error: timer fired early or out of order!" << endl;
+        failed = true;
+    }
+    last_after = delay;
+}
+
+void on_cancelled(event_loop* loop, void* args){
+    cout << "Error: cancelled timer fired!" << endl;
+    failed = true;
+}
+
+void on_every(event_loop* loop, void* args){
+    ++every_cnt;
+    cout << "run_every 100ms fired " << every_cnt << " times at +" << event_loop::now_ms() - start_ms << "ms" << endl;
+
+    //回调中取消自己
+    if(every_cnt == 5)
+        loop->cancel_timer(every_id);
+}
+
+void on_finish(event_loop* loop, void* args){
+    cout << "All timers done. run_every fired " << every_cnt << " times (expect 5)." << endl;
+    if(every_cnt != 5 || last_after != 250)
+        failed = true;
+    exit(failed ? 1 : 0);
+}
+
+int main(){
+    event_loop loop;
+    start_ms = event_loop::now_ms();
+
+    loop.run_after(50, on_after, (void*)50);
+    loop.run_after(10, on_after, (void*)10);
+    loop.run_at(start_ms + 250, on_after, (void*)250);
+
+    int id = loop.run_after(30, on_cancelled);
+    loop.cancel_timer(id);
+
+    every_id = loop.run_every(100, on_every);
+
+    loop.run_after(1000, on_finish);
+
+    loop.event_process();
+
+    return 0;
+}
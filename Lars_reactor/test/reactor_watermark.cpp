@@ -0,0 +1,99 @@
+#include "test_util.h"
+#include <vector>
+#include <atomic>
+using namespace std;
+
+//输出缓冲高低水位测试：客户端订阅后服务器不停推送带序号的消息(模拟路由推送)，推送方以write_blocked()限速。
+//客户端先不收，服务器输出缓冲越过高水位后触发高水位Hook，推送停住，缓冲不再增长；
+//客户端开始收后缓冲回落到低水位，写完Hook里继续推送。检查缓冲峰值、Hook次数，以及收到的序号连续完整。
+
+const char* IP = "127.0.0.1";
+const int PORT = 7794;
+const char* CONF = "/tmp/reactor_watermark.ini";
+const int HIGH_KB = 256;
+const int MSG_LEN = 8192;           //推送消息体长度
+const int TOTAL = 8192;             //推送消息总数，共64MB，远超过socket缓冲
+
+atomic<int> g_pushed(0);
+atomic<int> g_high_hits(0);
+atomic<int> g_complete_hits(0);
+atomic<int> g_peak(0);
+
+//推送到被限速或推完为止
+void push_more(net_connection* conn){
+    char msg[MSG_LEN] = {0};
+    while(g_pushed < TOTAL && !conn->write_blocked()){
+        int seq = g_pushed;
+        memcpy(msg, &seq, sizeof(seq));
+        if(conn->conn_write2fd(msg, MSG_LEN, 2) != 0)
+            return;
+        ++g_pushed;
+        g_peak = max(g_peak.load(), conn->output_length());
+    }
+}
+
+void subscribe(const char* data, uint32_t len, int msgid, net_connection* conn, void* usr_data){
+    push_more(conn);
+}
+
+void on_high_water(net_connection* conn, void* args){
+    ++g_high_hits;
+}
+
+void on_write_complete(net_connection* conn, void* args){
+    ++g_complete_hits;
+    push_more(conn);
+}
+
+int main(){
+    write_reactor_conf(CONF, "maxConns = 16\nthreadNums = 1\noutputHighWater = " + to_string(HIGH_KB) + "\noutputLowWater = 0\n");
+
+    //服务器日志不计入测试
+    streambuf* cout_buf = cout.rdbuf(nullptr);
+
+    event_loop* loop;
+    tcp_server* server = new_server(IP, PORT, &loop);
+    server->add_msg_router(1, subscribe);
+    server->set_high_watermark(on_high_water);
+    server->set_write_complete(on_write_complete);
+    run_loop(loop);
+
+    int fd = connect_server(IP, PORT);
+
+    //1. 订阅后先不收
+    msg_head head{(int)htonl(1), (int)htonl(0)};
+    if(write(fd, &head, MESSAGE_HEAD_LEN) != MESSAGE_HEAD_LEN){
+        cerr << "Write error." << endl;
+        return 1;
+    }
+    this_thread::sleep_for(chrono::milliseconds(500));
+    int stalled_at = g_pushed;
+    int stalled_peak = g_peak;
+
+    cout.rdbuf(cout_buf);
+    cout << "consumer stalled: pushed " << stalled_at << " of " << TOTAL << " msgs, output buffer peak "
+         << stalled_peak / 1024 << " kB (high water " << HIGH_KB << " kB), high water hooks " << g_high_hits << endl;
+    cout.rdbuf(nullptr);
+
+    //2. 开始收，检查序号连续
+    bool ok = stalled_at < TOTAL && g_high_hits > 0 && stalled_peak < (HIGH_KB * 1024 + MESSAGE_HEAD_LEN + MSG_LEN);
+    vector<char> msg(MESSAGE_HEAD_LEN + MSG_LEN);
+    for(int i = 0; i < TOTAL && ok; ++i){
+        if(!read_full(fd, msg.data(), msg.size())){
+            ok = false;
+            break;
+        }
+        int seq;
+        memcpy(&seq, msg.data() + MESSAGE_HEAD_LEN, sizeof(seq));
+        if(seq != i)
+            ok = false;
+    }
+
+    cout.rdbuf(cout_buf);
+    cout << "consumer resumed: " << (ok ? "all msgs received in order" : "FAILED") << ", write complete hooks "
+         << g_complete_hits << ", output buffer peak " << g_peak / 1024 << " kB" << endl;
+    cout.rdbuf(nullptr);
+
+    close(fd);
+    return ok && g_complete_hits > 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+//测试和压测程序共用的工具：写配置文件、起服务器、连服务器、收消息
+#pragma once
+#include "tcp_server.h"
+#include "config_file.h"
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+using namespace std;
+
+//写一个只有[reactor]段的配置文件，并设为全局配置。items形如"maxConns = 16\nthreadNums = 1\n"
+inline void write_reactor_conf(const char* path, const string& items){
+    ofstream conf(path);
+    conf << "[reactor]\n" << items;
+    conf.close();
+    config_file::setPath(path);
+}
+
+//服务器地址
+inline struct sockaddr_in server_addr(const char* ip, int port){
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &saddr.sin_addr);
+    return saddr;
+}
+
+//阻塞连接服务器，失败直接退出
+inline int connect_server(const char* ip, int port){
+    struct sockaddr_in saddr = server_addr(ip, port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1){
+        cerr << "Connect error." << endl;
+        exit(1);
+    }
+    return fd;
+}
+
+//读满len字节，对端关闭或出错返回false
+inline bool read_full(int fd, char* buf, int len){
+    while(len > 0){
+        int ret = read(fd, buf, len);
+        if(ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+//读一个消息，返回消息体。timeout_ms内没收全返回空串。fd被设为非阻塞
+inline string read_msg(int fd, int timeout_ms){
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    string buf;
+    auto end = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    while(chrono::steady_clock::now() < end){
+        char tmp[256];
+        int ret = read(fd, tmp, sizeof(tmp));
+        if(ret > 0)
+            buf.append(tmp, ret);
+        if(buf.size() >= MESSAGE_HEAD_LEN){
+            msg_head head;
+            memcpy(&head, buf.data(), MESSAGE_HEAD_LEN);
+            int len = ntohl(head.msglen);
+            if((int)buf.size() >= MESSAGE_HEAD_LEN + len)
+                return buf.substr(MESSAGE_HEAD_LEN, len);
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return "";
+}
+
+//在堆上创建服务器和它的主loop，loop传出。工作线程detach后一直在运行，
+//这两个对象要和进程同生命周期：放在main的栈上，main返回析构后工作线程还会访问它们
+inline tcp_server* new_server(const char* ip, int port, event_loop** loop){
+    *loop = new event_loop();
+    return new tcp_server(*loop, ip, port);
+}
+
+//在后台线程运行loop，和进程同生命周期
+inline void run_loop(event_loop* loop){
+    thread(&event_loop::event_process, loop).detach();
+}